@@ -5,6 +5,158 @@
 
 #define MAX_SEQ_LENGTH 1000
 
+#define RNAF_PLAIN 0    /** Write uncompressed output. */
+#define RNAF_GZIP  1    /** Write gzip output, as a series of gzip members. */
+#define RNAF_BGZF  2    /** Write BGZF output, compatible with gzip and samtools/htslib. */
+
+#define RNAF_CACHE_NAMES 0x01   /** Store the names of the records in a binary sequence cache. */
+#define RNAF_CACHE_QUALS 0x02   /** Store the qualities of the records in a binary sequence cache. */
+
+#define RNAF_BASE_A     0       /** Index of A in the counts of an RNA_PROFILE. */
+#define RNAF_BASE_C     1       /** Index of C in the counts of an RNA_PROFILE. */
+#define RNAF_BASE_G     2       /** Index of G in the counts of an RNA_PROFILE. */
+#define RNAF_BASE_T     3       /** Index of T and U in the counts of an RNA_PROFILE. */
+#define RNAF_BASE_N     4       /** Index of N in the counts of an RNA_PROFILE. */
+#define RNAF_BASE_OTHER 5       /** Index of every other character in the counts of an RNA_PROFILE. */
+#define RNAF_NUM_BASES  6
+
+#define RNAF_PROFILE_POSITIONS 1024 /** Positions whose bases an RNA_PROFILE counts one by one. */
+#define RNAF_LENGTH_BINS       64   /** Number of power-of-two bins of the lengths of longer sequences. */
+
+/**
+ *  Represents a memory allocator the library allocates from, see rnaf_set_allocator().
+ *
+ *  Either all three functions are set, or none of them for malloc(), realloc() and free(). Every
+ *  function receives `data`. The default allocator is called concurrently by the threads the
+ *  library starts, i.e. the workers of pairs, datasets, profiles and writers, so it must be
+ *  thread-safe. Allocation failures are reported as errors by the functions of the library, which
+ *  never exit the process.
+ */
+typedef struct RNA_ALLOCATOR {
+	void *(*malloc_fn)(void *data, size_t size);              /** Allocates size bytes. */
+	void *(*realloc_fn)(void *data, void *ptr, size_t size);  /** Resizes a block, like realloc(). */
+	void (*free_fn)(void *data, void *ptr);                   /** Frees a non-NULL block. */
+	void *data;                                                /** User pointer passed to them. */
+} RNA_ALLOCATOR;
+
+
+/**
+ *  Represents a single record of an RNA file, as returned by rnaf_next().
+ *
+ *  The strings are null-terminated, contain no line terminators, and point into memory owned by
+ *  the RNA_FILE they were read from. They are only valid until the next read from that file.
+ */
+typedef struct RNA_RECORD {
+	char *name;                     /** Header of the record without '>' or '@', or NULL. */
+	char *seq;                      /** Sequence of the record. */
+	char *qual;                     /** Quality string of the record, or NULL if there is none. */
+	size_t name_length;             /** Number of characters in name. */
+	size_t seq_length;              /** Number of characters in seq. */
+	size_t qual_length;             /** Number of characters in qual. */
+} RNA_RECORD;
+
+
+/**
+ *  Represents a batch of records, as filled by rnaf_read_batch().
+ *
+ *  Unlike records returned by rnaf_next(), the records of a batch own copies of their strings,
+ *  which remain valid until the batch is cleared, refilled, or freed.
+ */
+typedef struct RNA_BATCH {
+	RNA_RECORD *records;            /** Records held by the batch. */
+	size_t count;                   /** Number of records in the batch. */
+	size_t capacity;                /** Maximum number of records the batch can hold. */
+	char *data;                     /** Storage for the strings of the records. */
+	size_t data_size;               /** Size of data. */
+	size_t data_used;               /** Number of characters used in data. */
+} RNA_BATCH;
+
+
+/**
+ *  Represents the base composition and length distribution of the records of an RNA file, as
+ *  computed by rnaf_profile(). Bases are counted case-insensitively.
+ */
+typedef struct RNA_PROFILE {
+	size_t num_reads;               /** Number of records profiled. */
+	size_t num_bases;               /** Total number of characters in their sequences. */
+	size_t base_counts[RNAF_NUM_BASES];      /** Number of each base, indexed by RNAF_BASE_*. */
+	size_t *position_counts[RNAF_NUM_BASES]; /** Number of each base per position, i.e.
+	                                             position_counts[RNAF_BASE_G][p] is the number of
+	                                             sequences with a G at position p < num_positions. */
+	size_t overflow_counts[RNAF_NUM_BASES];  /** Number of each base at positions from
+	                                             RNAF_PROFILE_POSITIONS on, summed over them. */
+	size_t num_positions;           /** The smaller of max_length and RNAF_PROFILE_POSITIONS. */
+	size_t *length_counts;          /** Number of sequences per length, up to num_positions. */
+	size_t length_bins[RNAF_LENGTH_BINS];    /** Number of sequences longer than
+	                                             RNAF_PROFILE_POSITIONS per power of two, i.e.
+	                                             length_bins[k] counts lengths in [2^k, 2^(k+1)). */
+	size_t min_length;              /** Length of the shortest sequence. */
+	size_t max_length;              /** Length of the longest sequence. */
+	size_t gc_counts[101];          /** Number of sequences per percentage of G and C. */
+	double gc_content;              /** Fraction of G and C among all bases. */
+	double n_rate;                  /** Fraction of N among all bases. */
+} RNA_PROFILE;
+
+
+/**
+ *  Represents the estimated size of an RNA file, as computed by rnaf_estimate() from a sample of
+ *  its first records.
+ */
+typedef struct RNA_ESTIMATE {
+	size_t num_records;             /** Estimated number of records. */
+	size_t num_bytes;               /** Estimated number of characters after decompression. */
+	double records_error;           /** Relative error bound of num_records, e.g. 0.01 for 1%. */
+	double bytes_error;             /** Relative error bound of num_bytes, 0 if it is exact. */
+	size_t file_size;               /** Size of the file on disk. */
+	double ratio;                   /** Characters per byte of the file in the sample. */
+	double record_size;             /** Mean number of characters per record in the sample. */
+	size_t sample_records;          /** Number of records sampled. */
+	int exact;                      /** Whether the whole file was read, so the counts are exact. */
+} RNA_ESTIMATE;
+
+
+/**
+ *  Represents a pair of mate files (or an interleaved file) opened with rnaf_open_pair().
+ */
+typedef struct RNA_PAIR RNA_PAIR;
+
+
+/**
+ *  Represents a FASTA, FASTQ or sequence-per-line file opened for writing with rnaf_writer_open().
+ */
+typedef struct RNA_WRITER RNA_WRITER;
+
+
+/**
+ *  Represents a set of samples identified by inline barcodes, created with rnaf_demux_create().
+ */
+typedef struct RNA_DEMUX RNA_DEMUX;
+
+
+/**
+ *  Represents a binary sequence cache mapped into memory, see rnaf_cache_build().
+ */
+typedef struct RNA_CACHE RNA_CACHE;
+
+
+/**
+ *  Represents a set of RNA files read concurrently, opened with rnaf_dataset_open().
+ */
+typedef struct RNA_DATASET RNA_DATASET;
+
+
+/**
+ *  Represents a read-only index of the records of an RNA file, opened with rnaf_index_open().
+ */
+typedef struct RNA_INDEX RNA_INDEX;
+
+
+/**
+ *  Represents a read handle on an RNA_INDEX, created with rnaf_index_dup().
+ */
+typedef struct RNA_CURSOR RNA_CURSOR;
+
+
 /**
  *  Represents an RNA file for reading, including file information and a character buffer.
  *  The struct is used in conjunction with RNA file parsing functions.
@@ -18,6 +170,23 @@ typedef struct RNA_FILE {
 	unsigned long num_chars;        /** Number to store the total number of chars in file. */
 	unsigned long num_lines;        /** Number to store the total number of lines in file. */
     char filetype;                  /** Character to store which file type was passed. */
+	int crlf;                       /** Whether the lines of the file end with "\r\n". */
+	int (*parse)(struct RNA_FILE *, RNA_RECORD *); /** Parser selected for the file format. */
+	char *stream;                   /** Read-ahead buffer used by the parser. */
+	size_t stream_size;             /** Size of the read-ahead buffer. */
+	size_t stream_pos;              /** Position of the next unparsed character in stream. */
+	size_t stream_len;              /** Number of characters held in stream. */
+	int stream_eof;                 /** Whether the end of the file has been read into stream. */
+	int stream_error;               /** Whether reading failed, e.g. memory could not be allocated. */
+	char *record;                   /** Buffer to assemble records spanning multiple lines. */
+	size_t record_size;             /** Size of the record buffer. */
+	char *adapter;                  /** Adapter trimmed from the 3' end of every record, or NULL. */
+	size_t adapter_length;          /** Number of characters in adapter. */
+	size_t adapter_overlap;         /** Minimum overlap of a partial adapter at the 3' end. */
+	double adapter_error_rate;      /** Maximum fraction of mismatches in an adapter match. */
+	RNA_CACHE *cache;               /** Binary sequence cache the records are read from, or NULL. */
+	RNA_ALLOCATOR allocator;        /** Allocator of the memory of the file, see rnaf_open_with(). */
+	size_t file_size;               /** Size of the file on disk, 0 if unknown, see rnaf_progress(). */
 } RNA_FILE;
 
 
@@ -28,6 +197,9 @@ typedef struct RNA_FILE {
  *  to the RNA_FILE struct representing the opened file. This library currently only supports
  *  file reading for FASTA, FASTQ, text files with sequences.
  *
+ *  Binary sequence caches written by rnaf_cache_build() are recognized as well, and their
+ *  records are served from a memory mapping of the file without decompression or parsing.
+ *
  *  @param  filename The name of the RNA file to be opened.
  *  @return A pointer to the RNA_FILE struct representing the opened file, or NULL if there was an
  *  error.
@@ -36,6 +208,40 @@ RNA_FILE *
 rnaf_open(char *filename);
 
 
+/**
+ *  @brief Opens an RNA file for reading, allocating its memory with the given allocator.
+ *
+ *  Like rnaf_open(), but every allocation made for the file, including the strings returned by
+ *  rnaf_get(), is made with `allocator`, e.g. to allocate from an arena of the thread reading the
+ *  file. It is called by one thread at a time, though not necessarily the one that opened the
+ *  file, e.g. by the reader thread of rnaf_demux_run(). The allocator is copied.
+ *
+ *  @param filename  The name of the RNA file to be opened.
+ *  @param allocator The allocator to use, or NULL for the default allocator.
+ *
+ *  @return A pointer to the RNA_FILE struct representing the opened file, or NULL if there was an
+ *  error, e.g. the allocator sets only some of its functions.
+ */
+RNA_FILE *
+rnaf_open_with(char *filename, const RNA_ALLOCATOR *allocator);
+
+
+/**
+ *  @brief Sets the default allocator of the library.
+ *
+ *  Every handle opened afterwards without an allocator of its own, and every batch, allocates
+ *  from it. It must not be changed while memory allocated with the previous allocator is still in
+ *  use by the library.
+ *
+ *  @param allocator The allocator to use, which is copied, or NULL to use malloc() again.
+ *
+ *  @return 0 on success, or -1 if the allocator sets only some of its functions, which leaves the
+ *  default allocator as it was.
+ */
+int
+rnaf_set_allocator(const RNA_ALLOCATOR *allocator);
+
+
 /**
  *  @brief Retrieves the next sequence from the RNA file.
  *
@@ -44,16 +250,82 @@ rnaf_open(char *filename);
  *  parses accordingly. The retrieved sequence is dynamically allocated and returned.
  * 
  *  @note You have to free the string. Since memory is allocated to store the string, 
- *  it is then your responsibility to free the memory when it is no longer in use.
+ *  it is then your responsibility to free the memory when it is no longer in use, with the
+ *  allocator of the file (free() unless an allocator was set).
  *
  *  @param rna_file A pointer to the RNA_FILE struct representing the opened file.
- *  @return A dynamically allocated string containing the sequence, or NULL if there are no more
- *  sequences or an error occurs.
+ *  @return A dynamically allocated string containing the sequence without line terminators, or
+ *  NULL if there are no more sequences or an error occurs.
  */
 char *
 rnaf_get(RNA_FILE *rna_file);
 
 
+/**
+ *  @brief Reads the next record from the RNA file without copying it.
+ *
+ *  Unlike rnaf_get(), no memory is allocated: the fields of `record` point into the buffers of
+ *  rna_file and remain valid until the next read from rna_file. The contents may be modified in
+ *  place.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened file.
+ *  @param record   The record to fill.
+ *
+ *  @return 1 if a record was read, 0 if there are no more records, or -1 on error.
+ */
+int
+rnaf_next(RNA_FILE *rna_file, RNA_RECORD *record);
+
+
+/**
+ *  @brief Trims an adapter from the 3' end of every record read from the RNA file.
+ *
+ *  Once set, every record returned by rnaf_get(), rnaf_next() and rnaf_read_batch() is cut at the
+ *  first occurrence of the adapter. Occurrences may have up to `error_rate` mismatches per
+ *  compared character, and may be partial, i.e. a prefix of the adapter of at least
+ *  `min_overlap` characters hanging off the 3' end of the sequence. The record is trimmed in
+ *  place, so trimming costs no copy. Sequences streamed with rnaf_get_chunks() are not trimmed.
+ *
+ *  For example, with the adapter `"AGAUCGGAAG"` and an error_rate of 0.1, the sequence
+ *  `"ACGUACGUAGAUCGG"` is trimmed to `"ACGUACGU"`.
+ *
+ *  @param rna_file    A pointer to the RNA_FILE struct representing the opened file.
+ *  @param adapter     The adapter sequence, or NULL to stop trimming. The comparison is case
+ *                     sensitive.
+ *  @param error_rate  The maximum fraction of mismatches in an occurrence of the adapter, at
+ *                     least 0 and less than 1.
+ *  @param min_overlap The minimum number of characters of a partial adapter at the 3' end.
+ *
+ *  @return 0 on success, or -1 if error_rate is out of range, which keeps the previous adapter,
+ *  or if memory could not be allocated.
+ */
+int
+rnaf_set_adapter(RNA_FILE *rna_file, const char *adapter, double error_rate, size_t min_overlap);
+
+
+/**
+ *  @brief Builds a binary sequence cache of an RNA file.
+ *
+ *  The cache stores the sequences 2-bit packed, with a list of the positions of every other
+ *  character (such as N), and optionally the names and qualities of the records, each in its own
+ *  column with an index of record offsets. Opening the cache with rnaf_open() maps it into
+ *  memory, so repeated analyses of the same data skip decompression and parsing entirely.
+ *
+ *  Caches are meant to be read on the machine that built them, as the integers they contain are
+ *  stored in native byte order.
+ *
+ *  @param filename       The name of the RNA file to read.
+ *  @param cache_filename The name of the cache to write, e.g. ending in `.rnafc`.
+ *  @param flags          RNAF_CACHE_NAMES and/or RNAF_CACHE_QUALS, or 0 to only store sequences.
+ *                        Qualities are only stored for FASTQ files, names not for files with
+ *                        sequences per line.
+ *
+ *  @return 0 on success, or -1 on error.
+ */
+int
+rnaf_cache_build(char *filename, char *cache_filename, int flags);
+
+
 /**
  *  @brief Retrieves the next sequence that contains the string `match` within it.
  * 
@@ -69,6 +341,47 @@ char *
 rnaf_getm(RNA_FILE *rna_file, char *match);
 
 
+/**
+ *  Callback invoked by rnaf_get_chunks() for every window of a sequence.
+ *
+ *  @param chunk  Null-terminated window of the sequence, without line terminators. Only valid
+ *  for the duration of the call.
+ *  @param length Number of characters in chunk.
+ *  @param offset Position of the first character of chunk within the whole sequence.
+ *  @param data   User pointer passed to rnaf_get_chunks().
+ *
+ *  @return 0 to continue streaming, or any other value to skip the rest of the sequence.
+ */
+typedef int (*rnaf_chunk_fn)(const char *chunk, size_t length, size_t offset, void *data);
+
+
+/**
+ *  @brief Streams the next sequence from the RNA file in fixed-size windows.
+ *
+ *  Instead of returning the whole sequence like rnaf_get(), the sequence is delivered to `cb`
+ *  in windows of `chunk_size` characters. Lines are read in pieces, so memory use is bounded by
+ *  the window size and the read-ahead buffer of the file no matter how long the sequence or its
+ *  lines are; only the header of the record is held whole. Consecutive windows share `overlap` characters, which allows
+ *  sliding-window scans across window boundaries. The last window of a sequence may be shorter
+ *  than `chunk_size`.
+ *
+ *  For example, streaming the sequence `"ACGUACGUAC"` with a chunk_size of 4 and an overlap of 1
+ *  delivers `"ACGU"`, `"UACG"`, `"GUAC"` at offsets 0, 3 and 6.
+ *
+ *  @param rna_file   A pointer to the RNA_FILE struct representing the opened file.
+ *  @param cb         Function called with every window of the sequence.
+ *  @param chunk_size The number of characters in each window.
+ *  @param overlap    The number of characters shared by consecutive windows, must be smaller
+ *                    than chunk_size.
+ *  @param data       User pointer forwarded to cb.
+ *
+ *  @return 1 if a sequence was streamed, 0 if there are no more sequences, or -1 on error.
+ */
+int
+rnaf_get_chunks(RNA_FILE *rna_file, rnaf_chunk_fn cb, size_t chunk_size, size_t overlap,
+                void *data);
+
+
 /**
  *  @brief Read from the file until buffer is full.
  *
@@ -108,8 +421,10 @@ rnaf_close(RNA_FILE *rna_file);
  * 
  *  @param rna_file A pointer to the RNA_FILE struct representing the opened file
  *  @param size The new size of the buffer in bytes (number of chars)
+ *
+ *  @return 0 on success, or -1 if memory could not be allocated, leaving the buffer unchanged.
 */
-void
+int
 rnaf_rebuff(RNA_FILE *rna_file, size_t size);
 
 
@@ -149,4 +464,538 @@ rnaf_numchars(RNA_FILE *rna_file);
 unsigned long
 rnaf_numlines(RNA_FILE *rna_file);
 
+
+/**
+ *  @brief Creates an empty batch of records.
+ *
+ *  @param capacity The maximum number of records the batch can hold.
+ *
+ *  @return A pointer to the new batch, or NULL if memory could not be allocated. Free it with
+ *  rnaf_batch_free().
+ */
+RNA_BATCH *
+rnaf_batch_create(size_t capacity);
+
+
+/**
+ *  @brief Copies a record to the end of a batch.
+ *
+ *  @param batch  The batch to add the record to.
+ *  @param record The record to copy.
+ *
+ *  @return 1 if the record was added, 0 if the batch is full, or -1 if memory could not be
+ *  allocated.
+ */
+int
+rnaf_batch_add(RNA_BATCH *batch, const RNA_RECORD *record);
+
+
+/**
+ *  @brief Removes every record from a batch, keeping its memory for reuse.
+ *
+ *  @param batch The batch to clear.
+ */
+void
+rnaf_batch_clear(RNA_BATCH *batch);
+
+
+/**
+ *  @brief Frees a batch and the records it holds.
+ *
+ *  @param batch The batch to free, or NULL.
+ */
+void
+rnaf_batch_free(RNA_BATCH *batch);
+
+
+/**
+ *  @brief Fills a batch with the next records from the RNA file.
+ *
+ *  The batch is cleared, then filled with up to batch->capacity records.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened file.
+ *  @param batch    The batch to fill.
+ *
+ *  @return The number of records read, 0 if there are no more records, or -1 on error.
+ */
+int
+rnaf_read_batch(RNA_FILE *rna_file, RNA_BATCH *batch);
+
+
+/**
+ *  @brief Opens the two mate files of a paired-end library for synchronized reading.
+ *
+ *  Each mate file is decompressed and parsed on its own thread, so both mates are inflated in
+ *  parallel. If `filename2` is NULL, `filename1` is read as an interleaved file, in which every
+ *  record is immediately followed by its mate.
+ *
+ *  The names of the mates are compared as they are read, ignoring everything after the first
+ *  whitespace as well as trailing "/1" and "/2" suffixes. Mismatching names, or mate files with
+ *  a different number of records, are reported as errors.
+ *
+ *  @param filename1 The name of the file with the first mates, or of the interleaved file.
+ *  @param filename2 The name of the file with the second mates, or NULL.
+ *
+ *  @return A pointer to the RNA_PAIR representing the opened files, or NULL if there was an error.
+ */
+RNA_PAIR *
+rnaf_open_pair(char *filename1, char *filename2);
+
+
+/**
+ *  @brief Retrieves the next pair of mates.
+ *
+ *  The records remain valid until the next call to rnaf_pair_next() or rnaf_pair_batch().
+ *
+ *  @param pair  A pointer to the RNA_PAIR representing the opened files.
+ *  @param mate1 The record to fill with the first mate.
+ *  @param mate2 The record to fill with the second mate.
+ *
+ *  @return 1 if a pair was read, 0 if there are no more pairs, or -1 on error.
+ */
+int
+rnaf_pair_next(RNA_PAIR *pair, RNA_RECORD *mate1, RNA_RECORD *mate2);
+
+
+/**
+ *  @brief Retrieves the next batches of mates.
+ *
+ *  The i-th record of `mate1` is the mate of the i-th record of `mate2`. The batches are owned by
+ *  the RNA_PAIR and remain valid until the next call to rnaf_pair_next() or rnaf_pair_batch().
+ *
+ *  @param pair  A pointer to the RNA_PAIR representing the opened files.
+ *  @param mate1 Set to the batch with the first mates.
+ *  @param mate2 Set to the batch with the second mates.
+ *
+ *  @return The number of pairs in the batches, 0 if there are no more pairs, or -1 on error.
+ */
+int
+rnaf_pair_batch(RNA_PAIR *pair, RNA_BATCH **mate1, RNA_BATCH **mate2);
+
+
+/**
+ *  @brief Stops the reader threads and closes the mate files.
+ *
+ *  @param pair A pointer to the RNA_PAIR representing the opened files.
+ */
+void
+rnaf_close_pair(RNA_PAIR *pair);
+
+
+/**
+ *  @brief Opens a file for writing records.
+ *
+ *  Records are formatted into large blocks, which are compressed on a pool of `nthreads` worker
+ *  threads and written to the file in order. With `RNAF_BGZF`, every block is a BGZF block and
+ *  the file ends with the BGZF end-of-file marker. With `RNAF_GZIP`, every block is a separate
+ *  gzip member. Both can be read by rnaf_open() and any gzip reader.
+ *
+ *  @param filename    The name of the file to write.
+ *  @param filetype    The format to write: 'a' for FASTA, 'q' for FASTQ, or 'r' for sequences
+ *                     per line, matching RNA_FILE.filetype.
+ *  @param compression One of RNAF_PLAIN, RNAF_GZIP or RNAF_BGZF.
+ *  @param nthreads    The number of compression threads. With 0, blocks are compressed by the
+ *                     calling thread.
+ *
+ *  @return A pointer to the RNA_WRITER representing the opened file, or NULL if there was an error.
+ */
+RNA_WRITER *
+rnaf_writer_open(char *filename, char filetype, int compression, int nthreads);
+
+
+/**
+ *  @brief Writes a record.
+ *
+ *  The record is copied, so it may be a record returned by rnaf_next() or from a batch.
+ *
+ *  @param writer A pointer to the RNA_WRITER representing the opened file.
+ *  @param record The record to write. FASTQ output requires the record to have a quality string.
+ *
+ *  @return 0 on success, or -1 on error.
+ */
+int
+rnaf_writer_put(RNA_WRITER *writer, const RNA_RECORD *record);
+
+
+/**
+ *  @brief Writes every record of a batch.
+ *
+ *  @param writer A pointer to the RNA_WRITER representing the opened file.
+ *  @param batch  The batch of records to write.
+ *
+ *  @return 0 on success, or -1 on error.
+ */
+int
+rnaf_writer_put_batch(RNA_WRITER *writer, const RNA_BATCH *batch);
+
+
+/**
+ *  @brief Flushes the remaining records, stops the compression threads and closes the file.
+ *
+ *  @param writer A pointer to the RNA_WRITER representing the opened file.
+ *
+ *  @return 0 if every record was written, or -1 if there was an error.
+ */
+int
+rnaf_writer_close(RNA_WRITER *writer);
+
+
+/**
+ *  @brief Creates a demultiplexer for reads with an inline barcode and an optional UMI.
+ *
+ *  The barcode and UMI are read from fixed positions of every sequence. Barcodes are looked up
+ *  in a hash table holding every barcode and all of its neighbors with a single mismatch (or N),
+ *  so reads with up to one sequencing error in the barcode are assigned in constant time.
+ *  Neighbors shared by two barcodes are ambiguous and not assigned.
+ *
+ *  @param barcode_offset The position of the barcode in the sequence.
+ *  @param barcode_length The length of the barcode, at most 21.
+ *  @param umi_offset     The position of the UMI in the sequence.
+ *  @param umi_length     The length of the UMI, or 0 if the reads have no UMI.
+ *
+ *  @return A pointer to the new demultiplexer, or NULL if there was an error.
+ */
+RNA_DEMUX *
+rnaf_demux_create(size_t barcode_offset, size_t barcode_length, size_t umi_offset,
+                  size_t umi_length);
+
+
+/**
+ *  @brief Adds a sample to the demultiplexer.
+ *
+ *  @param demux   A pointer to the RNA_DEMUX.
+ *  @param barcode The barcode of the sample, made of A, C, G, T and U.
+ *  @param output  The writer that receives the reads of the sample.
+ *
+ *  @return The index of the sample, or -1 if the barcode is invalid or already used, or memory
+ *  could not be allocated.
+ */
+int
+rnaf_demux_add_sample(RNA_DEMUX *demux, const char *barcode, RNA_WRITER *output);
+
+
+/**
+ *  @brief Sets the writer that receives the reads that match no sample.
+ *
+ *  By default, reads that match no sample are discarded.
+ *
+ *  @param demux  A pointer to the RNA_DEMUX.
+ *  @param output The writer that receives the unmatched reads, or NULL.
+ */
+void
+rnaf_demux_set_unmatched(RNA_DEMUX *demux, RNA_WRITER *output);
+
+
+/**
+ *  @brief Looks up the sample of a barcode.
+ *
+ *  @param demux   A pointer to the RNA_DEMUX.
+ *  @param barcode The barcode to look up, of the length given to rnaf_demux_create().
+ *
+ *  @return The index of the sample, or -1 if the barcode matches no sample or is ambiguous.
+ */
+int
+rnaf_demux_lookup(const RNA_DEMUX *demux, const char *barcode);
+
+
+/**
+ *  @brief Assigns every record of the RNA file to its sample in a single pass.
+ *
+ *  The file is read on a separate thread while the records are assigned. The barcode, the UMI
+ *  and everything before them are removed from the sequence (and quality), and the UMI is
+ *  appended to the read id as `id_UMI`, before the written record is handed to the sample's
+ *  writer.
+ *
+ *  @param demux    A pointer to the RNA_DEMUX.
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened file.
+ *
+ *  @return The number of records read, or -1 on error.
+ */
+long
+rnaf_demux_run(RNA_DEMUX *demux, RNA_FILE *rna_file);
+
+
+/**
+ *  @brief Retrieves the number of records assigned to a sample by rnaf_demux_run().
+ *
+ *  @param demux  A pointer to the RNA_DEMUX.
+ *  @param sample The index of the sample, or -1 for the records that matched no sample.
+ *
+ *  @return The number of records assigned to the sample.
+ */
+size_t
+rnaf_demux_count(const RNA_DEMUX *demux, int sample);
+
+
+/**
+ *  @brief Frees the demultiplexer. The writers of the samples are not closed.
+ *
+ *  @param demux A pointer to the RNA_DEMUX.
+ */
+void
+rnaf_demux_free(RNA_DEMUX *demux);
+
+
+
+/**
+ *  @brief Opens a set of RNA files for concurrent reading.
+ *
+ *  The files are opened, decompressed and parsed into batches by a pool of `nthreads` worker
+ *  threads, each reading one file at a time, so many small files keep every thread busy. Batches
+ *  are read ahead until they hold `memory_budget` bytes, and are handed out by
+ *  rnaf_dataset_next() tagged with the file they were read from.
+ *
+ *  @param filenames     The names of the RNA files to read.
+ *  @param num_files     The number of files.
+ *  @param nthreads      The number of reader threads, at least 1.
+ *  @param memory_budget The number of bytes the batches read ahead may hold, or 0 for 256 MiB.
+ *                       The file being handed out in order may exceed it.
+ *  @param ordered       Nonzero to hand out every batch of a file before the batches of the next
+ *                       file, or 0 to hand out batches as soon as they are read, from any file.
+ *                       The batches of a single file are always handed out in order.
+ *
+ *  @return A pointer to the RNA_DATASET representing the files, or NULL if memory could not be
+ *  allocated. Files that fail to open are reported by rnaf_dataset_next().
+ */
+RNA_DATASET *
+rnaf_dataset_open(char **filenames, size_t num_files, int nthreads, size_t memory_budget,
+                  int ordered);
+
+
+/**
+ *  @brief Opens the RNA files matching a glob pattern for concurrent reading.
+ *
+ *  The files are read in the sorted order of their names, see rnaf_dataset_open().
+ *
+ *  @param pattern       The glob pattern, e.g. `"selex/round*_rep?.fq.gz"`.
+ *  @param nthreads      The number of reader threads, at least 1.
+ *  @param memory_budget The number of bytes the batches read ahead may hold, or 0 for 256 MiB.
+ *  @param ordered       Nonzero to hand out the files one after the other, or 0 to interleave.
+ *
+ *  @return A pointer to the RNA_DATASET representing the files, or NULL if no file matches.
+ */
+RNA_DATASET *
+rnaf_dataset_glob(const char *pattern, int nthreads, size_t memory_budget, int ordered);
+
+
+/**
+ *  @brief Retrieves the next batch of records of the dataset.
+ *
+ *  The batch is owned by the RNA_DATASET and remains valid until the next call to
+ *  rnaf_dataset_next(), which hands its memory back to the reader threads.
+ *
+ *  @param dataset A pointer to the RNA_DATASET representing the files.
+ *  @param batch   Set to the batch.
+ *  @param file    Set to the index of the file the batch was read from, or NULL.
+ *
+ *  @return The number of records in the batch, 0 if there are no more records, or -1 if a file
+ *  could not be read.
+ */
+int
+rnaf_dataset_next(RNA_DATASET *dataset, RNA_BATCH **batch, size_t *file);
+
+
+/**
+ *  @brief Retrieves the name of a file of the dataset.
+ *
+ *  @param dataset A pointer to the RNA_DATASET representing the files.
+ *  @param file    The index of the file, as returned by rnaf_dataset_next().
+ *
+ *  @return The name of the file, or NULL if there is no such file.
+ */
+const char *
+rnaf_dataset_filename(const RNA_DATASET *dataset, size_t file);
+
+
+/**
+ *  @brief Stops the reader threads and closes the files of the dataset.
+ *
+ *  @param dataset A pointer to the RNA_DATASET representing the files.
+ */
+void
+rnaf_dataset_close(RNA_DATASET *dataset);
+
+
+/**
+ *  @brief Opens an RNA file for reading regions of its records at random.
+ *
+ *  Binary sequence caches written by rnaf_cache_build() are mapped into memory. Uncompressed
+ *  FASTA files, FASTQ files with single-line records, and files with sequences per line are
+ *  scanned once to record where every record starts and how its lines are laid out, like a FASTA
+ *  index (.fai), and are read with pread(). Compressed files cannot be read at random positions,
+ *  build a cache of them instead.
+ *
+ *  The index is never modified after it is opened, so it may be shared by any number of threads,
+ *  each reading through its own RNA_CURSOR.
+ *
+ *  @param filename The name of the RNA file or cache to index.
+ *
+ *  @return A pointer to the RNA_INDEX, or NULL if there was an error.
+ */
+RNA_INDEX *
+rnaf_index_open(char *filename);
+
+
+/**
+ *  @brief Creates a read handle on an index.
+ *
+ *  A cursor only holds a buffer for the regions it fetches, so creating one per thread (or per
+ *  request) is cheap. A cursor must not be used by two threads at the same time.
+ *
+ *  @param index A pointer to the RNA_INDEX.
+ *
+ *  @return A pointer to the new cursor, or NULL if memory could not be allocated. Free it with
+ *  rnaf_cursor_close().
+ */
+RNA_CURSOR *
+rnaf_index_dup(const RNA_INDEX *index);
+
+
+/**
+ *  @brief Retrieves the number of records of an index.
+ *
+ *  @param index A pointer to the RNA_INDEX.
+ *
+ *  @return The number of records.
+ */
+size_t
+rnaf_index_count(const RNA_INDEX *index);
+
+
+/**
+ *  @brief Retrieves the length of the sequence of a record.
+ *
+ *  @param index  A pointer to the RNA_INDEX.
+ *  @param record The index of the record.
+ *
+ *  @return The number of characters in the sequence, or 0 if there is no such record.
+ */
+size_t
+rnaf_index_length(const RNA_INDEX *index, size_t record);
+
+
+/**
+ *  @brief Looks up a record by its id.
+ *
+ *  Ids are compared up to the first whitespace of the name, so `"ENST0001"` finds the record
+ *  named `"ENST0001 gene=ABC"`. If several records have the same id, the first one is found.
+ *
+ *  @param index A pointer to the RNA_INDEX.
+ *  @param name  The id of the record.
+ *
+ *  @return The index of the record, or -1 if there is no such record or the records have no names.
+ */
+long
+rnaf_index_find(const RNA_INDEX *index, const char *name);
+
+
+/**
+ *  @brief Reads a region of the sequence of a record.
+ *
+ *  The region is clamped to the end of the sequence. The name of `out` points into the index
+ *  and the sequence into the cursor, where it remains valid until the next fetch with the cursor.
+ *  Its quality is NULL.
+ *
+ *  @param cursor A pointer to the RNA_CURSOR to read with.
+ *  @param record The index of the record.
+ *  @param start  The position of the first character of the region.
+ *  @param length The number of characters in the region.
+ *  @param out    The record to fill with the name of the record and the region.
+ *
+ *  @return 1 if the region was read, 0 if there is no such record or start lies past the end of
+ *  its sequence, or -1 on error.
+ */
+int
+rnaf_fetch(RNA_CURSOR *cursor, size_t record, size_t start, size_t length, RNA_RECORD *out);
+
+
+/**
+ *  @brief Frees a cursor.
+ *
+ *  @param cursor A pointer to the RNA_CURSOR.
+ */
+void
+rnaf_cursor_close(RNA_CURSOR *cursor);
+
+
+/**
+ *  @brief Closes an index. Every cursor on it must be closed first.
+ *
+ *  @param index A pointer to the RNA_INDEX.
+ */
+void
+rnaf_index_close(RNA_INDEX *index);
+
+
+/**
+ *  @brief Computes the base composition and length distribution of the records of an RNA file.
+ *
+ *  The records remaining in rna_file are profiled in a single pass: they are decompressed and
+ *  parsed on the calling thread, while `nthreads` worker threads count the bases of every
+ *  position 16 at a time into partial profiles, which are merged at the end. Bases and lengths
+ *  are counted per position up to RNAF_PROFILE_POSITIONS only, so long reads need no more memory
+ *  than short ones.
+ *
+ *  @param rna_file  A pointer to the RNA_FILE struct representing the opened file.
+ *  @param profile   The profile to fill, cleared first even on error. Free its counts with
+ *                   rnaf_profile_free().
+ *  @param max_reads The number of records after which to stop, e.g. for a quick check of the
+ *                   first reads, or 0 to profile every record.
+ *  @param nthreads  The number of counting threads. With 0, records are counted by the calling
+ *                   thread.
+ *
+ *  @return The number of records profiled, or -1 on error.
+ */
+long
+rnaf_profile(RNA_FILE *rna_file, RNA_PROFILE *profile, size_t max_reads, int nthreads);
+
+
+/**
+ *  @brief Frees the counts of a profile filled by rnaf_profile().
+ *
+ *  @param profile A pointer to the RNA_PROFILE.
+ */
+void
+rnaf_profile_free(RNA_PROFILE *profile);
+
+
+/**
+ *  @brief Estimates the number of records and characters of an RNA file without reading it all.
+ *
+ *  Only the records in the first `sample_size` bytes of the file are read. Their mean size and
+ *  the compression ratio of the sample extrapolate the rest of the file from its size on disk.
+ *  The number of characters is exact for uncompressed and BGZF files, whose blocks record their
+ *  decompressed size, and for gzip files whose trailer size (ISIZE) agrees with the sample.
+ *  A record longer than the sample is only read in part, its sampled length stands in for the
+ *  mean size and the error bound of num_records is at least 100%. Binary sequence caches hold the
+ *  exact counts, num_bytes is then their number of sequence, quality and name characters.
+ *
+ *  The error bounds span three standard errors of the sampled record sizes and compression
+ *  ratios, i.e. they assume the sample is representative of the rest of the file.
+ *
+ *  @param filename    The name of the RNA file.
+ *  @param estimate    The estimate to fill.
+ *  @param sample_size The number of bytes of the file to sample, or 0 for 4 MiB.
+ *
+ *  @return 0 on success, or -1 if the file could not be read.
+ */
+int
+rnaf_estimate(char *filename, RNA_ESTIMATE *estimate, size_t sample_size);
+
+
+/**
+ *  @brief Reports how much of an RNA file has been read.
+ *
+ *  Progress is measured in bytes of the file on disk, i.e. compressed bytes for compressed files,
+ *  so it is cheap to query after every batch. It must be called from the thread reading the file.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened file.
+ *  @param consumed Receives the number of bytes of the file consumed so far, or NULL.
+ *  @param total    Receives the size of the file, or NULL.
+ *
+ *  @return The fraction of the file consumed, between 0 and 1, or -1 on error.
+ */
+double
+rnaf_progress(RNA_FILE *rna_file, size_t *consumed, size_t *total);
+
 #endif // RNAF_H
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rnaf.h"
+#include "memory_utils.h"
+
+#define BATCH_DATA_SIZE 65536   /* Initial size of the string storage of a batch */
+
+/* Function declarations */
+static int
+batch_reserve(RNA_BATCH *batch, size_t length);
+
+static char *
+batch_copy(RNA_BATCH *batch, const char *str, size_t length);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+RNA_BATCH *
+rnaf_batch_create(size_t capacity)
+{
+	RNA_BATCH *batch = s_malloc(sizeof *batch);
+
+	if(batch == NULL) {
+		return NULL;
+	}
+
+	batch->records = s_malloc(capacity * sizeof *batch->records);
+	batch->count = 0;
+	batch->capacity = capacity;
+	batch->data = s_malloc(BATCH_DATA_SIZE * sizeof(char));
+	batch->data_size = BATCH_DATA_SIZE;
+	batch->data_used = 0;
+
+	if(batch->records == NULL || batch->data == NULL) {
+		rnaf_batch_free(batch);
+		return NULL;
+	}
+
+	return batch;
+}
+
+
+int
+rnaf_batch_add(RNA_BATCH *batch, const RNA_RECORD *record)
+{
+	RNA_RECORD *copy;
+
+	if(batch->count == batch->capacity) {
+		return 0;
+	}
+
+	/* Reserve space for every string up front, so growing doesn't move them halfway */
+	if(batch_reserve(batch, record->name_length + record->seq_length + record->qual_length + 3)) {
+		return -1;
+	}
+
+	copy = &batch->records[batch->count++];
+	copy->name = record->name ? batch_copy(batch, record->name, record->name_length) : NULL;
+	copy->name_length = record->name_length;
+	copy->seq = batch_copy(batch, record->seq, record->seq_length);
+	copy->seq_length = record->seq_length;
+	copy->qual = record->qual ? batch_copy(batch, record->qual, record->qual_length) : NULL;
+	copy->qual_length = record->qual_length;
+
+	return 1;
+}
+
+
+void
+rnaf_batch_clear(RNA_BATCH *batch)
+{
+	batch->count = 0;
+	batch->data_used = 0;
+}
+
+
+void
+rnaf_batch_free(RNA_BATCH *batch)
+{
+	if(batch == NULL) {
+		return;
+	}
+
+	s_free(batch->data);
+	s_free(batch->records);
+	s_free(batch);
+}
+
+
+int
+rnaf_read_batch(RNA_FILE *rna_file, RNA_BATCH *batch)
+{
+	RNA_RECORD record;
+	int        ret = 0;
+
+	rnaf_batch_clear(batch);
+	while(batch->count < batch->capacity && (ret = rnaf_next(rna_file, &record)) == 1) {
+		if(rnaf_batch_add(batch, &record) < 0) {
+			return -1;
+		}
+	}
+
+	return ret < 0 ? -1 : (int)batch->count;
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+/* Grows the string storage to fit length more characters, returns -1 if it cannot grow */
+static int
+batch_reserve(RNA_BATCH *batch, size_t length)
+{
+	char   *data;
+	size_t size = batch->data_size;
+
+	if(batch->data_used + length <= size) {
+		return 0;
+	}
+
+	while(batch->data_used + length > size) {
+		size *= 2;
+	}
+
+	/* Records point into data, so move them along with it */
+	if((data = s_malloc(size * sizeof(char))) == NULL) {
+		return -1;
+	}
+	memcpy(data, batch->data, batch->data_used * sizeof(char));
+	for(size_t i = 0; i < batch->count; i++) {
+		RNA_RECORD *record = &batch->records[i];
+		record->name = record->name ? data + (record->name - batch->data) : NULL;
+		record->seq = data + (record->seq - batch->data);
+		record->qual = record->qual ? data + (record->qual - batch->data) : NULL;
+	}
+
+	s_free(batch->data);
+	batch->data = data;
+	batch->data_size = size;
+	return 0;
+}
+
+
+static char *
+batch_copy(RNA_BATCH *batch, const char *str, size_t length)
+{
+	char *copy = batch->data + batch->data_used;
+
+	memcpy(copy, str, length * sizeof(char));
+	copy[length] = '\0';
+	batch->data_used += length+1;
+
+	return copy;
+}
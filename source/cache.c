@@ -0,0 +1,617 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rnaf.h"
+#include "cache.h"
+#include "memory_utils.h"
+
+#define CACHE_U 0x80    /* Base code 3 is decoded as 'U' instead of 'T' */
+
+/*
+ *  Layout of a binary sequence cache. Every section starts at an offset that is a multiple of 8:
+ *
+ *  header           cache_header
+ *  seq              num_bases 2-bit codes of A, C, G and T (or U), four per byte
+ *  starts           uint64_t[num_records+1], position of the first base of every record in seq
+ *  exceptions       uint64_t[num_exceptions], sorted positions of bases that are not A, C, G, T/U
+ *  exception_chars  char[num_exceptions], the characters at those positions
+ *  quals            the null-terminated quality of every record (RNAF_CACHE_QUALS)
+ *  name_starts      uint64_t[num_records+1], offset of every name in names (RNAF_CACHE_NAMES)
+ *  names            the null-terminated name of every record (RNAF_CACHE_NAMES)
+ */
+typedef struct cache_header {
+	char     magic[CACHE_MAGIC_LEN];
+	uint64_t flags;
+	uint64_t num_records;
+	uint64_t num_bases;
+	uint64_t num_exceptions;
+	uint64_t seq_offset;
+	uint64_t starts_offset;
+	uint64_t exceptions_offset;
+	uint64_t exception_chars_offset;
+	uint64_t quals_offset;
+	uint64_t name_starts_offset;
+	uint64_t names_offset;
+} cache_header;
+
+struct RNA_CACHE {
+	unsigned char       *map;
+	size_t              map_size;
+	const cache_header  *header;
+	const unsigned char *seq;
+	const uint64_t      *starts;
+	const uint64_t      *exceptions;
+	const char          *exception_chars;
+	const char          *quals;
+	const uint64_t      *name_starts;
+	const char          *names;
+	uint64_t            next;           /* Next record returned by parse_cache() */
+	uint64_t            exception;      /* First exception that may belong to the next record */
+	char                unpack[256][4]; /* The four bases of every byte of seq */
+};
+
+/* Codes of the bases of a sequence plus one */
+static const unsigned char base_code[256] = {
+	['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4, ['U'] = 4,
+};
+
+/* Function declarations */
+static int
+parse_cache(RNA_FILE *rna_file, RNA_RECORD *record);
+
+
+static bool
+cache_section(const RNA_CACHE *cache, uint64_t offset, uint64_t count, size_t size);
+
+static int
+append_section(FILE *out, FILE *section, uint64_t *offset);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+int
+rnaf_cache_build(char *filename, char *cache_filename, int flags)
+{
+	RNA_FILE      *rna_file;
+	RNA_RECORD    record;
+	cache_header  header = {.seq_offset = sizeof(cache_header)};
+	FILE          *out;
+	FILE          *sections[6];
+	FILE          *starts, *exceptions, *exception_chars, *quals, *name_starts, *names;
+	unsigned char packed = 0;
+	unsigned char code;
+	char          code3 = '\0';     /* Whether the file uses T or U */
+	uint64_t      names_used = 0;
+	uint64_t      zero = 0;
+	int           ret = 0;
+	int           status = 0;
+
+	if((rna_file = rnaf_open(filename)) == NULL) {
+		return -1;
+	}
+	if(rna_file->filetype != 'q') {
+		flags &= ~RNAF_CACHE_QUALS;
+	}
+	if(rna_file->filetype == 'r') {
+		flags &= ~RNAF_CACHE_NAMES;
+	}
+
+	if((out = fopen(cache_filename, "w+b")) == NULL) {
+		error_message("Failed to open file '%s': %s", cache_filename, strerror(errno));
+		rnaf_close(rna_file);
+		return -1;
+	}
+
+	/* Columns are collected in temporary files, so memory use doesn't depend on the input */
+	for(int i = 0; i < 6; i++) {
+		if((sections[i] = tmpfile()) == NULL) {
+			error_message("Failed to create temporary file: %s", strerror(errno));
+			while(i--) {
+				fclose(sections[i]);
+			}
+			fclose(out);
+			rnaf_close(rna_file);
+			return -1;
+		}
+	}
+	starts = sections[0];
+	exceptions = sections[1];
+	exception_chars = sections[2];
+	quals = sections[3];
+	name_starts = sections[4];
+	names = sections[5];
+
+	/* A full disk must never leave a truncated cache behind, so every write is checked */
+	if(fwrite(&header, sizeof header, 1, out) != 1 || fwrite(&zero, sizeof zero, 1, starts) != 1 ||
+	   fwrite(&zero, sizeof zero, 1, name_starts) != 1) {
+		status = -1;
+	}
+
+	while(!status && (ret = rnaf_next(rna_file, &record)) == 1) {
+		for(size_t i = 0; i < record.seq_length; i++) {
+			code = base_code[(unsigned char)record.seq[i]];
+			if(code == 4 && code3 == '\0') {
+				code3 = record.seq[i];
+			}
+
+			/* Anything else is stored as an A, and restored from the exceptions */
+			if(code == 0 || (code == 4 && record.seq[i] != code3)) {
+				if(fwrite(&header.num_bases, sizeof header.num_bases, 1, exceptions) != 1 ||
+				   fputc(record.seq[i], exception_chars) == EOF) {
+					status = -1;
+				}
+				header.num_exceptions++;
+				code = 1;
+			}
+
+			packed |= (code-1) << (2 * (header.num_bases & 3));
+			if((++header.num_bases & 3) == 0) {
+				if(fputc(packed, out) == EOF) {
+					status = -1;
+				}
+				packed = 0;
+			}
+		}
+		if(fwrite(&header.num_bases, sizeof header.num_bases, 1, starts) != 1) {
+			status = -1;
+		}
+
+		if(flags & RNAF_CACHE_QUALS) {
+			if(record.qual_length != record.seq_length) {
+				error_message("Record '%s' has a quality of a different length than its sequence.",
+				              record.name);
+				status = -1;
+			}
+			if(fwrite(record.qual, 1, record.qual_length + 1, quals) != record.qual_length + 1) {
+				status = -1;
+			}
+		}
+
+		if(flags & RNAF_CACHE_NAMES) {
+			names_used += record.name_length + 1;
+			if(fwrite(record.name, 1, record.name_length + 1, names) != record.name_length + 1 ||
+			   fwrite(&names_used, sizeof names_used, 1, name_starts) != 1) {
+				status = -1;
+			}
+		}
+
+		header.num_records++;
+	}
+	if(ret < 0) {
+		status = -1;
+	}
+
+	if((header.num_bases & 3) && fputc(packed, out) == EOF) {
+		status = -1;
+	}
+
+	memcpy(header.magic, CACHE_MAGIC, CACHE_MAGIC_LEN);
+	header.flags = flags | (code3 == 'U' ? CACHE_U : 0);
+	if(!status) {
+		status |= append_section(out, starts, &header.starts_offset);
+		status |= append_section(out, exceptions, &header.exceptions_offset);
+		status |= append_section(out, exception_chars, &header.exception_chars_offset);
+		if(flags & RNAF_CACHE_QUALS) {
+			status |= append_section(out, quals, &header.quals_offset);
+		}
+		if(flags & RNAF_CACHE_NAMES) {
+			status |= append_section(out, name_starts, &header.name_starts_offset);
+			status |= append_section(out, names, &header.names_offset);
+		}
+	}
+
+	/* Write the header last, so an interrupted build never looks like a valid cache */
+	if(!status && (fseek(out, 0, SEEK_SET) || fwrite(&header, sizeof header, 1, out) != 1)) {
+		status = -1;
+	}
+	if(fclose(out) && !status) {
+		status = -1;
+	}
+	if(status) {
+		error_message("Failed to build cache '%s' of file '%s'.", cache_filename, filename);
+		remove(cache_filename);
+	}
+
+	for(int i = 0; i < 6; i++) {
+		fclose(sections[i]);
+	}
+	rnaf_close(rna_file);
+
+	return status;
+}
+
+
+int
+cache_open(RNA_FILE *rna_file)
+{
+	RNA_CACHE *cache;
+
+	if((cache = cache_map(rna_file->filename)) == NULL) {
+		return -1;
+	}
+
+	rna_file->cache = cache;
+	rna_file->parse = parse_cache;
+	rna_file->filetype = cache->quals ? 'q' : cache->names ? 'a' : 'r';
+	return 1;
+}
+
+
+RNA_CACHE *
+cache_map(const char *filename)
+{
+	RNA_CACHE          *cache;
+	const cache_header *header;
+	struct stat        st;
+	void               *map;
+	char               letters[4] = {'A', 'C', 'G', 'T'};
+	bool               valid;
+	int                fd;
+
+	if((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) ||
+	   (size_t)st.st_size < sizeof(cache_header)) {
+		error_message("Failed to map cache '%s': %s", filename, strerror(errno));
+		if(fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	/* The mapping is never written, so the cursors of any number of threads may share it */
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		error_message("Failed to map cache '%s': %s", filename, strerror(errno));
+		return NULL;
+	}
+
+	if((cache = s_calloc(1, sizeof *cache)) == NULL) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	cache->map = map;
+	cache->map_size = st.st_size;
+	cache->header = header = map;
+
+	/* Check every section lies within the file */
+	if(memcmp(header->magic, CACHE_MAGIC, CACHE_MAGIC_LEN) ||
+	   header->num_records >= cache->map_size || header->num_exceptions >= cache->map_size ||
+	   header->num_bases / 4 >= cache->map_size ||
+	   !cache_section(cache, header->seq_offset, (header->num_bases+3) / 4, 1) ||
+	   !cache_section(cache, header->starts_offset, header->num_records+1, sizeof(uint64_t)) ||
+	   !cache_section(cache, header->exceptions_offset, header->num_exceptions, sizeof(uint64_t)) ||
+	   !cache_section(cache, header->exception_chars_offset, header->num_exceptions, 1) ||
+	   ((header->flags & RNAF_CACHE_QUALS) &&
+	    !cache_section(cache, header->quals_offset, header->num_bases + header->num_records, 1)) ||
+	   ((header->flags & RNAF_CACHE_NAMES) &&
+	    !cache_section(cache, header->name_starts_offset, header->num_records+1, sizeof(uint64_t)))) {
+		error_message("File '%s' is not a valid cache.", filename);
+		cache_unmap(cache);
+		return NULL;
+	}
+
+	cache->seq = cache->map + header->seq_offset;
+	cache->starts = (const uint64_t *)(cache->map + header->starts_offset);
+	cache->exceptions = (const uint64_t *)(cache->map + header->exceptions_offset);
+	cache->exception_chars = (const char *)cache->map + header->exception_chars_offset;
+	if(header->flags & RNAF_CACHE_QUALS) {
+		cache->quals = (const char *)cache->map + header->quals_offset;
+	}
+	if(header->flags & RNAF_CACHE_NAMES) {
+		cache->name_starts = (const uint64_t *)(cache->map + header->name_starts_offset);
+		cache->names = (const char *)cache->map + header->names_offset;
+
+		/* Names are used as offsets, so each must start after the previous one within the file, and
+		   be terminated */
+		valid = cache->name_starts[0] == 0;
+		for(uint64_t i = 0; valid && i < header->num_records; i++) {
+			valid = cache->name_starts[i+1] > cache->name_starts[i];
+		}
+		valid = valid &&
+		        cache_section(cache, header->names_offset, cache->name_starts[header->num_records], 1);
+		for(uint64_t i = 1; valid && i <= header->num_records; i++) {
+			valid = cache->names[cache->name_starts[i]-1] == '\0';
+		}
+		if(!valid) {
+			error_message("File '%s' is not a valid cache.", filename);
+			cache_unmap(cache);
+			return NULL;
+		}
+	}
+
+	/* Records are decoded at their starts and exceptions restored in order, so the starts must
+	   partition the bases and the exceptions be sorted positions of bases */
+	valid = cache->starts[header->num_records] == header->num_bases;
+	for(uint64_t i = 0; valid && i < header->num_records; i++) {
+		valid = cache->starts[i+1] >= cache->starts[i];
+	}
+	for(uint64_t i = 0; valid && i < header->num_exceptions; i++) {
+		valid = cache->exceptions[i] < header->num_bases &&
+		        (i == 0 || cache->exceptions[i] > cache->exceptions[i-1]);
+	}
+	if(!valid) {
+		error_message("File '%s' is not a valid cache.", filename);
+		cache_unmap(cache);
+		return NULL;
+	}
+
+	if(header->flags & CACHE_U) {
+		letters[3] = 'U';
+	}
+	for(int byte = 0; byte < 256; byte++) {
+		for(int i = 0; i < 4; i++) {
+			cache->unpack[byte][i] = letters[(byte >> (2*i)) & 3];
+		}
+	}
+
+	return cache;
+}
+
+
+size_t
+cache_count(const RNA_CACHE *cache)
+{
+	return cache->header->num_records;
+}
+
+
+size_t
+cache_next(const RNA_CACHE *cache)
+{
+	return cache->next;
+}
+
+
+size_t
+cache_characters(const RNA_CACHE *cache)
+{
+	const cache_header *header = cache->header;
+	size_t             characters = header->num_bases;
+
+	/* Every quality is as long as its sequence, every name is followed by its terminator */
+	if(header->flags & RNAF_CACHE_QUALS) {
+		characters += header->num_bases;
+	}
+	if(header->flags & RNAF_CACHE_NAMES) {
+		characters += cache->name_starts[header->num_records] - header->num_records;
+	}
+
+	return characters;
+}
+
+
+int
+cache_record(const RNA_CACHE *cache, size_t index, RNA_RECORD *record)
+{
+	uint64_t start = cache->starts[index];
+	uint64_t end = cache->starts[index+1];
+
+	/* Names were checked by cache_map() */
+	if(end < start || end > cache->header->num_bases) {
+		return -1;
+	}
+
+	record->seq = NULL;
+	record->seq_length = end - start;
+	record->qual = cache->quals ? (char *)cache->quals + start + index : NULL;
+	record->qual_length = cache->quals ? end - start : 0;
+	record->name = cache->names ? (char *)cache->names + cache->name_starts[index] : NULL;
+	record->name_length = cache->names ?
+	                      cache->name_starts[index+1] - cache->name_starts[index] - 1 : 0;
+	return 0;
+}
+
+
+void
+cache_decode(const RNA_CACHE *cache, size_t index, size_t start, size_t length, char *seq,
+             uint64_t *exception)
+{
+	uint64_t pos = cache->starts[index] + start;
+	uint64_t first = pos;
+	uint64_t end = pos + length;
+	uint64_t num_exceptions = cache->header->num_exceptions;
+	uint64_t low = 0;
+	uint64_t high = num_exceptions;
+	uint64_t mid;
+	char     *out = seq;
+
+	/* Decode a whole byte at once, except at the edges of the region */
+	for(; pos < end && (pos & 3); pos++) {
+		*out++ = cache->unpack[cache->seq[pos >> 2]][pos & 3];
+	}
+	for(; pos + 4 <= end; pos += 4, out += 4) {
+		memcpy(out, cache->unpack[cache->seq[pos >> 2]], 4);
+	}
+	for(; pos < end; pos++) {
+		*out++ = cache->unpack[cache->seq[pos >> 2]][pos & 3];
+	}
+	*out = '\0';
+
+	/* Regions are usually read in order, otherwise find the first exception of the region */
+	if((*exception && cache->exceptions[*exception-1] >= first) ||
+	   (*exception < num_exceptions && cache->exceptions[*exception] < first)) {
+		while(low < high) {
+			mid = low + (high-low) / 2;
+			if(cache->exceptions[mid] < first) {
+				low = mid+1;
+			} else {
+				high = mid;
+			}
+		}
+		*exception = low;
+	}
+
+	/* Restore the characters that are not A, C, G, T or U, never writing outside the region */
+	for(; *exception < num_exceptions && cache->exceptions[*exception] < end; (*exception)++) {
+		if(cache->exceptions[*exception] >= first) {
+			seq[cache->exceptions[*exception] - first] = cache->exception_chars[*exception];
+		}
+	}
+}
+
+
+void
+cache_rewind(RNA_FILE *rna_file)
+{
+	rna_file->cache->next = 0;
+	rna_file->cache->exception = 0;
+}
+
+
+int
+cache_stream(RNA_FILE *rna_file, line_sink sink, void *data)
+{
+	RNA_CACHE  *cache = rna_file->cache;
+	RNA_RECORD record;
+	size_t     length;
+
+	if(cache->next == cache->header->num_records) {
+		return 0;
+	}
+
+	if(cache_record(cache, cache->next, &record)) {
+		error_message("Corrupted record %llu in cache '%s'.", (unsigned long long)cache->next,
+		              rna_file->filename);
+		return -1;
+	}
+
+	/* Caches do not read the stream otherwise, so the sequence is decoded into it piece by piece */
+	for(size_t start = 0; start < record.seq_length; start += length) {
+		length = record.seq_length - start;
+		if(length > rna_file->stream_size - 1) {
+			length = rna_file->stream_size - 1;
+		}
+		cache_decode(cache, cache->next, start, length, rna_file->stream, &cache->exception);
+		if(sink(data, rna_file->stream, length)) {
+			break;
+		}
+	}
+
+	cache->next++;
+	return 1;
+}
+
+
+void
+cache_close(RNA_FILE *rna_file)
+{
+	cache_unmap(rna_file->cache);
+	rna_file->cache = NULL;
+}
+
+
+void
+cache_unmap(RNA_CACHE *cache)
+{
+	munmap(cache->map, cache->map_size);
+	s_free(cache);
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+static int
+parse_cache(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	RNA_CACHE *cache = rna_file->cache;
+	uint64_t  i = cache->next;
+	size_t    size = rna_file->record_size;
+	size_t    length;
+	char      *buffer;
+
+	if(i == cache->header->num_records) {
+		return 0;
+	}
+
+	if(cache_record(cache, i, record)) {
+		error_message("Corrupted record %llu in cache '%s'.", (unsigned long long)i,
+		              rna_file->filename);
+		return -1;
+	}
+
+	/* The mapping is read-only, so the record is assembled in the record buffer, where it may be
+	   trimmed in place: the decoded sequence, then the quality and the name */
+	length = record->seq_length+1 + (record->qual ? record->qual_length+1 : 0) +
+	         (record->name ? record->name_length+1 : 0);
+	if(length > size) {
+		while(length > size) {
+			size *= 2;
+		}
+		if((buffer = a_realloc(&rna_file->allocator, rna_file->record, size * sizeof(char))) == NULL) {
+			return -1;
+		}
+		rna_file->record = buffer;
+		rna_file->record_size = size;
+	}
+
+	cache_decode(cache, i, 0, record->seq_length, rna_file->record, &cache->exception);
+	record->seq = rna_file->record;
+	buffer = rna_file->record + record->seq_length+1;
+	if(record->qual) {
+		memcpy(buffer, record->qual, record->qual_length);
+		buffer[record->qual_length] = '\0';
+		record->qual = buffer;
+		buffer += record->qual_length+1;
+	}
+	if(record->name) {
+		memcpy(buffer, record->name, record->name_length);
+		buffer[record->name_length] = '\0';
+		record->name = buffer;
+	}
+
+	cache->next++;
+	return 1;
+}
+
+
+static bool
+cache_section(const RNA_CACHE *cache, uint64_t offset, uint64_t count, size_t size)
+{
+	return offset % 8 == 0 && offset <= cache->map_size &&
+	       count <= (cache->map_size - offset) / size;
+}
+
+
+/* Appends section to out at the next multiple of 8, which is stored in offset */
+static int
+append_section(FILE *out, FILE *section, uint64_t *offset)
+{
+	char   buf[65536];
+	size_t length;
+	long   position = ftell(out);
+
+	if(position < 0) {
+		return -1;
+	}
+	while(position % 8) {
+		if(fputc('\0', out) == EOF) {
+			return -1;
+		}
+		position++;
+	}
+	*offset = position;
+
+	/* Unlike rewind(), fseek() reports a failure to flush the section */
+	if(ferror(section) || fseek(section, 0, SEEK_SET)) {
+		return -1;
+	}
+	while((length = fread(buf, 1, sizeof buf, section)) > 0) {
+		if(fwrite(buf, 1, length, out) != length) {
+			return -1;
+		}
+	}
+
+	return ferror(section) ? -1 : 0;
+}
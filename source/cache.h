@@ -0,0 +1,134 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+#include "rnaf.h"
+#include "parser.h"
+
+#define CACHE_MAGIC     "RNAFC\x01\r\n"     /* First 8 characters of a binary sequence cache */
+#define CACHE_MAGIC_LEN 8
+
+
+/**
+ *  @brief Serve the records of rna_file from its binary sequence cache.
+ *
+ *  Maps the file into memory and selects the parser that decodes records from the mapping.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct of a file starting with CACHE_MAGIC
+ *
+ *  @return 1 on success, or -1 if the file is not a valid cache
+*/
+int cache_open(RNA_FILE *rna_file);
+
+
+/**
+ *  @brief Start reading the cache of rna_file from the first record again.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened cache
+*/
+void cache_rewind(RNA_FILE *rna_file);
+
+
+/**
+ *  @brief Read the next record of the cache, passing its sequence to sink.
+ *
+ *  The sequence is decoded into the stream of rna_file, which caches do not use otherwise, and
+ *  passed on in pieces of at most its size.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened cache
+ *  @param sink     Function called with every piece of the sequence of the record
+ *  @param data     User pointer forwarded to sink
+ *
+ *  @return 1 if a record was read, 0 if there are no more records, or -1 if it is corrupted
+*/
+int cache_stream(RNA_FILE *rna_file, line_sink sink, void *data);
+
+
+/**
+ *  @brief Unmap the cache of rna_file.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened cache
+*/
+void cache_close(RNA_FILE *rna_file);
+
+
+/**
+ *  @brief Map a binary sequence cache into memory and validate it.
+ *
+ *  The mapping is only read afterwards, so it may be shared by any number of threads.
+ *
+ *  @param filename The name of the cache
+ *
+ *  @return The mapped cache, or NULL if the file is not a valid cache
+*/
+RNA_CACHE *cache_map(const char *filename);
+
+
+/**
+ *  @brief Unmap a cache mapped with cache_map().
+ *
+ *  @param cache The mapped cache
+*/
+void cache_unmap(RNA_CACHE *cache);
+
+
+/**
+ *  @brief Get the number of records in a cache.
+ *
+ *  @param cache The mapped cache
+ *
+ *  @return The number of records
+*/
+size_t cache_count(const RNA_CACHE *cache);
+
+
+/**
+ *  @brief Get the index of the next record read from a cache by rnaf_next().
+ *
+ *  @param cache The mapped cache
+ *
+ *  @return The index of the next record, cache_count() once every record has been read
+*/
+size_t cache_next(const RNA_CACHE *cache);
+
+
+/**
+ *  @brief Get the number of sequence, quality and name characters of the records in a cache.
+ *
+ *  @param cache The mapped cache
+ *
+ *  @return The number of characters
+*/
+size_t cache_characters(const RNA_CACHE *cache);
+
+
+/**
+ *  @brief Get the name, quality and sequence length of a record without decoding its sequence.
+ *
+ *  @param cache  The mapped cache
+ *  @param index  The index of the record, smaller than cache_count()
+ *  @param record The record to fill, its seq is set to NULL. Its name and qual point into the
+ *                read-only mapping, so they must not be modified. Only the name is checked to be
+ *                null-terminated
+ *
+ *  @return 0 on success, or -1 if the record is corrupted
+*/
+int cache_record(const RNA_CACHE *cache, size_t index, RNA_RECORD *record);
+
+
+/**
+ *  @brief Decode a region of the sequence of a record.
+ *
+ *  @param cache     The mapped cache
+ *  @param index     The index of the record, checked with cache_record()
+ *  @param start     The position of the region within the sequence
+ *  @param length    The number of bases in the region, which must lie within the sequence
+ *  @param seq       Receives the null-terminated region, at least length+1 characters
+ *  @param exception Cursor into the exceptions, 0 initially, which makes decoding consecutive
+ *                   regions cheap. Every thread needs its own.
+*/
+void cache_decode(const RNA_CACHE *cache, size_t index, size_t start, size_t length, char *seq,
+                  uint64_t *exception);
+
+#endif // CACHE_H
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <glob.h>
+#include <pthread.h>
+
+#include "rnaf.h"
+#include "memory_utils.h"
+
+#define DATASET_BATCH_SIZE    4096          /* Number of records read from a file at once */
+#define DATASET_MEMORY_BUDGET 268435456     /* Default memory held by the batches read ahead */
+#define DATASET_WAIT          2
+
+/* Struct to queue a batch read from a file */
+typedef struct dataset_batch {
+	RNA_BATCH            *batch;
+	size_t               bytes;     /* Memory of the batch counted against the budget */
+	size_t               file;
+	struct dataset_batch *next;
+} dataset_batch;
+
+/* Struct to contain a file of the dataset and the batches read from it */
+typedef struct dataset_file {
+	char          *filename;
+	dataset_batch *head;
+	dataset_batch *tail;
+	bool          finished;     /* Whether every batch of the file has been queued */
+	int           status;
+} dataset_file;
+
+struct RNA_DATASET {
+	dataset_file    *files;
+	size_t          num_files;
+	size_t          next_file;      /* Next file opened by a worker thread */
+	size_t          current;        /* File batches are handed out from */
+	bool            ordered;
+	size_t          memory_budget;
+	size_t          memory_used;
+	dataset_batch   *free;          /* Batches handed back, for reuse */
+	dataset_batch   *held;          /* Batch currently handed out */
+	pthread_t       *threads;
+	int             nthreads;
+	bool            stop;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+};
+
+/* Function declarations */
+static void *
+dataset_work(void *arg);
+
+static int
+dataset_take(RNA_DATASET *dataset, dataset_batch **item);
+
+static size_t
+batch_bytes(const RNA_BATCH *batch);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+RNA_DATASET *
+rnaf_dataset_open(char **filenames, size_t num_files, int nthreads, size_t memory_budget,
+                  int ordered)
+{
+	RNA_DATASET *dataset = s_calloc(1, sizeof *dataset);
+	bool        failed;
+
+	if(dataset == NULL) {
+		return NULL;
+	}
+
+	dataset->nthreads = nthreads > 0 ? nthreads : 1;
+	dataset->threads = s_malloc(dataset->nthreads * sizeof *dataset->threads);
+	dataset->files = s_calloc(num_files, sizeof *dataset->files);
+	failed = dataset->threads == NULL || (num_files && dataset->files == NULL);
+	for(size_t i = 0; !failed && i < num_files; i++) {
+		if((dataset->files[i].filename = s_malloc(strlen(filenames[i]) + 1)) == NULL) {
+			failed = true;
+		} else {
+			strcpy(dataset->files[i].filename, filenames[i]);
+		}
+	}
+
+	if(failed) {
+		for(size_t i = 0; dataset->files && i < num_files; i++) {
+			s_free(dataset->files[i].filename);
+		}
+		s_free(dataset->files);
+		s_free(dataset->threads);
+		s_free(dataset);
+		return NULL;
+	}
+
+	dataset->num_files = num_files;
+	dataset->ordered = ordered;
+	dataset->memory_budget = memory_budget ? memory_budget : DATASET_MEMORY_BUDGET;
+
+	pthread_mutex_init(&dataset->lock, NULL);
+	pthread_cond_init(&dataset->cond, NULL);
+	for(int i = 0; i < dataset->nthreads; i++) {
+		if(pthread_create(&dataset->threads[i], NULL, dataset_work, dataset)) {
+			error_message("Failed to start a worker thread of the dataset.");
+
+			/* Only the threads started are joined */
+			dataset->nthreads = i;
+			rnaf_dataset_close(dataset);
+			return NULL;
+		}
+	}
+
+	return dataset;
+}
+
+
+RNA_DATASET *
+rnaf_dataset_glob(const char *pattern, int nthreads, size_t memory_budget, int ordered)
+{
+	RNA_DATASET *dataset;
+	glob_t      matches;
+
+	if(glob(pattern, 0, NULL, &matches) != 0) {
+		error_message("No files match '%s'.", pattern);
+		globfree(&matches);
+		return NULL;
+	}
+
+	/* The matches are sorted, so rounds and replicates keep their natural order */
+	dataset = rnaf_dataset_open(matches.gl_pathv, matches.gl_pathc, nthreads, memory_budget,
+	                            ordered);
+	globfree(&matches);
+
+	return dataset;
+}
+
+
+int
+rnaf_dataset_next(RNA_DATASET *dataset, RNA_BATCH **batch, size_t *file)
+{
+	dataset_batch *item = NULL;
+	int           ret;
+
+	pthread_mutex_lock(&dataset->lock);
+
+	/* Hand the previous batch back to the worker threads */
+	if(dataset->held) {
+		dataset->memory_used -= dataset->held->bytes;
+		dataset->held->next = dataset->free;
+		dataset->free = dataset->held;
+		dataset->held = NULL;
+		pthread_cond_broadcast(&dataset->cond);
+	}
+
+	while((ret = dataset_take(dataset, &item)) == DATASET_WAIT) {
+		pthread_cond_wait(&dataset->cond, &dataset->lock);
+	}
+
+	pthread_mutex_unlock(&dataset->lock);
+
+	if(ret <= 0) {
+		return ret;
+	}
+
+	dataset->held = item;
+	*batch = item->batch;
+	if(file) {
+		*file = item->file;
+	}
+	return (int)item->batch->count;
+}
+
+
+const char *
+rnaf_dataset_filename(const RNA_DATASET *dataset, size_t file)
+{
+	return file < dataset->num_files ? dataset->files[file].filename : NULL;
+}
+
+
+void
+rnaf_dataset_close(RNA_DATASET *dataset)
+{
+	dataset_batch *item;
+
+	pthread_mutex_lock(&dataset->lock);
+	dataset->stop = true;
+	pthread_cond_broadcast(&dataset->cond);
+	pthread_mutex_unlock(&dataset->lock);
+	for(int i = 0; i < dataset->nthreads; i++) {
+		pthread_join(dataset->threads[i], NULL);
+	}
+
+	if(dataset->held) {
+		dataset->held->next = dataset->free;
+		dataset->free = dataset->held;
+	}
+	for(size_t i = 0; i < dataset->num_files; i++) {
+		if(dataset->files[i].tail) {
+			dataset->files[i].tail->next = dataset->free;
+			dataset->free = dataset->files[i].head;
+		}
+		s_free(dataset->files[i].filename);
+	}
+	while((item = dataset->free)) {
+		dataset->free = item->next;
+		rnaf_batch_free(item->batch);
+		s_free(item);
+	}
+
+	pthread_cond_destroy(&dataset->cond);
+	pthread_mutex_destroy(&dataset->lock);
+	s_free(dataset->threads);
+	s_free(dataset->files);
+	s_free(dataset);
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+static void *
+dataset_work(void *arg)
+{
+	RNA_DATASET   *dataset = arg;
+	RNA_FILE      *rna_file;
+	dataset_batch *item;
+	dataset_file  *entry;
+	size_t        index;
+	int           status;
+
+	pthread_mutex_lock(&dataset->lock);
+	while(!dataset->stop && dataset->next_file < dataset->num_files) {
+		index = dataset->next_file++;
+		entry = &dataset->files[index];
+		pthread_mutex_unlock(&dataset->lock);
+
+		rna_file = rnaf_open(entry->filename);
+		status = rna_file ? 1 : -1;
+
+		while(status > 0) {
+			/* Wait for memory, unless the file is the one the batches are handed out from */
+			pthread_mutex_lock(&dataset->lock);
+			while(!dataset->stop && dataset->memory_used >= dataset->memory_budget &&
+			      !(dataset->ordered && index == dataset->current)) {
+				pthread_cond_wait(&dataset->cond, &dataset->lock);
+			}
+			if(dataset->stop) {
+				pthread_mutex_unlock(&dataset->lock);
+				break;
+			}
+			if((item = dataset->free)) {
+				dataset->free = item->next;
+			}
+			pthread_mutex_unlock(&dataset->lock);
+
+			if(item == NULL && (item = s_calloc(1, sizeof *item)) != NULL) {
+				item->batch = rnaf_batch_create(DATASET_BATCH_SIZE);
+			}
+
+			if(item && item->batch == NULL) {
+				s_free(item);
+				item = NULL;
+			}
+
+			if(item == NULL) {
+				status = -1;
+			} else {
+				status = rnaf_read_batch(rna_file, item->batch);
+				item->bytes = batch_bytes(item->batch);
+				item->file = index;
+				item->next = NULL;
+			}
+
+			pthread_mutex_lock(&dataset->lock);
+			if(status > 0) {
+				if(entry->tail) {
+					entry->tail->next = item;
+				} else {
+					entry->head = item;
+				}
+				entry->tail = item;
+				dataset->memory_used += item->bytes;
+			} else if(item) {
+				item->next = dataset->free;
+				dataset->free = item;
+			}
+			pthread_cond_broadcast(&dataset->cond);
+			pthread_mutex_unlock(&dataset->lock);
+		}
+
+		if(rna_file) {
+			rnaf_close(rna_file);
+		}
+
+		pthread_mutex_lock(&dataset->lock);
+		entry->finished = true;
+		entry->status = status < 0 ? -1 : 0;
+		pthread_cond_broadcast(&dataset->cond);
+	}
+	pthread_mutex_unlock(&dataset->lock);
+
+	return NULL;
+}
+
+
+/* Dequeues the next batch to hand out, returns 1 if a batch was dequeued, 0 if there are no more
+   batches, -1 on error, or DATASET_WAIT if the next batch has not been read yet */
+static int
+dataset_take(RNA_DATASET *dataset, dataset_batch **item)
+{
+	dataset_file *entry;
+	size_t       index;
+	size_t       drained = 0;
+
+	/* Batches are handed out file by file, or round-robin from every file that has one */
+	for(size_t i = 0; i < dataset->num_files; i++) {
+		index = dataset->ordered ? i : (dataset->current + i) % dataset->num_files;
+		if(index < dataset->current && dataset->ordered) {
+			continue;
+		}
+		entry = &dataset->files[index];
+
+		if(entry->head) {
+			*item = entry->head;
+			if((entry->head = entry->head->next) == NULL) {
+				entry->tail = NULL;
+			}
+			if(!dataset->ordered) {
+				dataset->current = (index+1) % dataset->num_files;
+			}
+			return 1;
+		}
+
+		if(entry->finished && entry->status < 0) {
+			return -1;
+		}
+
+		if(!entry->finished) {
+			if(dataset->ordered) {
+				return DATASET_WAIT;
+			}
+			continue;
+		}
+
+		if(dataset->ordered) {
+			/* Let the worker reading the next file use memory beyond the budget */
+			dataset->current++;
+			pthread_cond_broadcast(&dataset->cond);
+		}
+		drained++;
+	}
+
+	if(dataset->ordered || drained == dataset->num_files) {
+		return 0;
+	}
+
+	return DATASET_WAIT;
+}
+
+
+/* Returns the memory held by a batch */
+static size_t
+batch_bytes(const RNA_BATCH *batch)
+{
+	return sizeof *batch + batch->capacity * sizeof(RNA_RECORD) + batch->data_size;
+}
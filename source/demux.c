@@ -0,0 +1,497 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "rnaf.h"
+#include "memory_utils.h"
+
+#define MAX_BARCODE_LENGTH 21       /* Barcodes are packed with 3 bits per base into a key */
+#define DEMUX_TABLE_SIZE   1024     /* Initial number of slots of the barcode table */
+#define DEMUX_BATCH_SIZE   4096     /* Number of records read ahead at once */
+#define EMPTY_KEY          UINT64_MAX
+#define AMBIGUOUS          -2
+
+/* Codes of the bases of a barcode plus one, a mismatch may also be an N */
+static const unsigned char base_code[256] = {
+	['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4, ['U'] = 4, ['N'] = 5,
+	['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4, ['u'] = 4, ['n'] = 5,
+};
+
+/* Struct to contain the batches read ahead by the reader thread */
+typedef struct demux_reader {
+	RNA_FILE        *file;
+	RNA_BATCH       *batch[2];
+	int             status[2];
+	bool            filled[2];
+	bool            stop;
+	pthread_t       thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+} demux_reader;
+
+struct RNA_DEMUX {
+	size_t        barcode_offset;
+	size_t        barcode_length;
+	size_t        umi_offset;
+	size_t        umi_length;
+	size_t        trim;             /* Characters removed from the beginning of every read */
+	uint64_t      *keys;            /* Open addressing table of barcodes and their neighbors */
+	int           *samples;
+	bool          *exact;
+	size_t        table_size;
+	size_t        table_used;
+	RNA_WRITER    **outputs;
+	size_t        *counts;
+	int           num_samples;
+	RNA_WRITER    *unmatched;
+	size_t        unmatched_count;
+	char          *name;            /* Buffer to build the names of the written reads */
+	size_t        name_size;
+};
+
+/* Function declarations */
+static uint64_t
+barcode_key(const char *barcode, size_t length);
+
+static size_t
+table_find(const RNA_DEMUX *demux, uint64_t key);
+
+static void
+table_insert(RNA_DEMUX *demux, uint64_t key, int sample, bool exact);
+
+static int
+table_reserve(RNA_DEMUX *demux, size_t count);
+
+static int
+demux_route(RNA_DEMUX *demux, const RNA_RECORD *record);
+
+static void *
+demux_read(void *arg);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+RNA_DEMUX *
+rnaf_demux_create(size_t barcode_offset, size_t barcode_length, size_t umi_offset,
+                  size_t umi_length)
+{
+	RNA_DEMUX *demux;
+
+	if(barcode_length == 0 || barcode_length > MAX_BARCODE_LENGTH) {
+		error_message("Barcode length must be between 1 and %d.", MAX_BARCODE_LENGTH);
+		return NULL;
+	}
+
+	if((demux = s_calloc(1, sizeof *demux)) == NULL) {
+		return NULL;
+	}
+	demux->barcode_offset = barcode_offset;
+	demux->barcode_length = barcode_length;
+	demux->umi_offset = umi_offset;
+	demux->umi_length = umi_length;
+	demux->trim = MAX2(barcode_offset + barcode_length, umi_length ? umi_offset + umi_length : 0);
+
+	demux->table_size = DEMUX_TABLE_SIZE;
+	demux->keys = s_malloc(demux->table_size * sizeof *demux->keys);
+	demux->samples = s_malloc(demux->table_size * sizeof *demux->samples);
+	demux->exact = s_malloc(demux->table_size * sizeof *demux->exact);
+	if(!demux->keys || !demux->samples || !demux->exact) {
+		rnaf_demux_free(demux);
+		return NULL;
+	}
+	for(size_t i = 0; i < demux->table_size; i++) {
+		demux->keys[i] = EMPTY_KEY;
+	}
+
+	return demux;
+}
+
+
+int
+rnaf_demux_add_sample(RNA_DEMUX *demux, const char *barcode, RNA_WRITER *output)
+{
+	uint64_t   key;
+	uint64_t   neighbor;
+	size_t     slot;
+	int        sample = demux->num_samples;
+	RNA_WRITER **outputs;
+	size_t     *counts;
+
+	key = strlen(barcode) == demux->barcode_length ?
+	      barcode_key(barcode, demux->barcode_length) : EMPTY_KEY;
+	for(size_t i = 0; key != EMPTY_KEY && i < demux->barcode_length; i++) {
+		if(base_code[(unsigned char)barcode[i]] > 4) {
+			key = EMPTY_KEY;    /* Only A, C, G, T and U identify a sample */
+		}
+	}
+
+	if(key == EMPTY_KEY) {
+		error_message("Invalid barcode '%s', expected %zu bases.", barcode, demux->barcode_length);
+		return -1;
+	}
+
+	slot = table_find(demux, key);
+	if(demux->keys[slot] == key && demux->exact[slot]) {
+		error_message("Barcode '%s' is used by more than one sample.", barcode);
+		return -1;
+	}
+
+	/* Make room for the barcode and its neighbors first, so a failure leaves no trace */
+	if(table_reserve(demux, 1 + 4 * demux->barcode_length)) {
+		return -1;
+	}
+	if((outputs = s_realloc(demux->outputs, (sample+1) * sizeof *demux->outputs)) == NULL) {
+		return -1;
+	}
+	demux->outputs = outputs;
+	if((counts = s_realloc(demux->counts, (sample+1) * sizeof *demux->counts)) == NULL) {
+		return -1;
+	}
+	demux->counts = counts;
+	demux->outputs[sample] = output;
+	demux->counts[sample] = 0;
+	demux->num_samples++;
+
+	table_insert(demux, key, sample, true);
+
+	/* Every base may be replaced by any other base or an N */
+	for(size_t i = 0; i < demux->barcode_length; i++) {
+		uint64_t shift = 3 * (demux->barcode_length-1-i);
+		uint64_t code = (key >> shift) & 7;
+
+		for(uint64_t other = 0; other <= 4; other++) {
+			if(other != code) {
+				neighbor = (key & ~((uint64_t)7 << shift)) | (other << shift);
+				table_insert(demux, neighbor, sample, false);
+			}
+		}
+	}
+
+	return sample;
+}
+
+
+void
+rnaf_demux_set_unmatched(RNA_DEMUX *demux, RNA_WRITER *output)
+{
+	demux->unmatched = output;
+}
+
+
+int
+rnaf_demux_lookup(const RNA_DEMUX *demux, const char *barcode)
+{
+	uint64_t key = barcode_key(barcode, demux->barcode_length);
+	size_t   slot;
+
+	if(key == EMPTY_KEY) {
+		return -1;
+	}
+
+	slot = table_find(demux, key);
+	if(demux->keys[slot] != key || demux->samples[slot] == AMBIGUOUS) {
+		return -1;
+	}
+
+	return demux->samples[slot];
+}
+
+
+long
+rnaf_demux_run(RNA_DEMUX *demux, RNA_FILE *rna_file)
+{
+	demux_reader reader = {.file = rna_file};
+	RNA_BATCH    *batch;
+	long         total = 0;
+	int          next = 0;
+	int          status;
+
+	reader.batch[0] = rnaf_batch_create(DEMUX_BATCH_SIZE);
+	reader.batch[1] = rnaf_batch_create(DEMUX_BATCH_SIZE);
+	if(reader.batch[0] == NULL || reader.batch[1] == NULL) {
+		rnaf_batch_free(reader.batch[0]);
+		rnaf_batch_free(reader.batch[1]);
+		return -1;
+	}
+	pthread_mutex_init(&reader.lock, NULL);
+	pthread_cond_init(&reader.cond, NULL);
+	if(pthread_create(&reader.thread, NULL, demux_read, &reader)) {
+		error_message("Failed to start the reader thread of file '%s'.", rna_file->filename);
+		pthread_cond_destroy(&reader.cond);
+		pthread_mutex_destroy(&reader.lock);
+		rnaf_batch_free(reader.batch[0]);
+		rnaf_batch_free(reader.batch[1]);
+		return -1;
+	}
+
+	/* Assign one batch while the reader thread fills the other */
+	do {
+		pthread_mutex_lock(&reader.lock);
+		while(!reader.filled[next]) {
+			pthread_cond_wait(&reader.cond, &reader.lock);
+		}
+		pthread_mutex_unlock(&reader.lock);
+
+		batch = reader.batch[next];
+		status = reader.status[next];
+		for(size_t i = 0; status > 0 && i < batch->count; i++) {
+			if(demux_route(demux, &batch->records[i])) {
+				status = -1;
+			}
+		}
+		total += status > 0 ? status : 0;
+
+		pthread_mutex_lock(&reader.lock);
+		reader.filled[next] = false;
+		reader.stop = status <= 0;
+		pthread_cond_broadcast(&reader.cond);
+		pthread_mutex_unlock(&reader.lock);
+
+		next = !next;
+	} while(status > 0);
+
+	pthread_join(reader.thread, NULL);
+	pthread_cond_destroy(&reader.cond);
+	pthread_mutex_destroy(&reader.lock);
+	rnaf_batch_free(reader.batch[0]);
+	rnaf_batch_free(reader.batch[1]);
+
+	return status < 0 ? -1 : total;
+}
+
+
+size_t
+rnaf_demux_count(const RNA_DEMUX *demux, int sample)
+{
+	if(sample < 0 || sample >= demux->num_samples) {
+		return demux->unmatched_count;
+	}
+
+	return demux->counts[sample];
+}
+
+
+void
+rnaf_demux_free(RNA_DEMUX *demux)
+{
+	s_free(demux->keys);
+	s_free(demux->samples);
+	s_free(demux->exact);
+	s_free(demux->outputs);
+	s_free(demux->counts);
+	s_free(demux->name);
+	s_free(demux);
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+static uint64_t
+barcode_key(const char *barcode, size_t length)
+{
+	uint64_t      key = 0;
+	unsigned char code;
+
+	for(size_t i = 0; i < length; i++) {
+		if((code = base_code[(unsigned char)barcode[i]]) == 0) {
+			return EMPTY_KEY;
+		}
+		key = (key << 3) | (code-1);
+	}
+
+	return key;
+}
+
+
+/* Returns the slot of key, or the empty slot where it would be inserted */
+static size_t
+table_find(const RNA_DEMUX *demux, uint64_t key)
+{
+	uint64_t hash = key;
+	size_t   mask = demux->table_size - 1;
+	size_t   slot;
+
+	/* splitmix64 finalizer, so neighboring barcodes spread over the table */
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+	hash ^= hash >> 31;
+
+	for(slot = hash & mask; demux->keys[slot] != EMPTY_KEY && demux->keys[slot] != key;
+	    slot = (slot+1) & mask);
+
+	return slot;
+}
+
+
+static void
+table_insert(RNA_DEMUX *demux, uint64_t key, int sample, bool exact)
+{
+	size_t slot = table_find(demux, key);
+
+	if(demux->keys[slot] == EMPTY_KEY) {
+		demux->keys[slot] = key;
+		demux->samples[slot] = sample;
+		demux->exact[slot] = exact;
+		demux->table_used++;
+
+	} else if(exact) {
+		/* A barcode always identifies its own sample, even if it neighbors another one */
+		demux->samples[slot] = sample;
+		demux->exact[slot] = true;
+
+	} else if(!demux->exact[slot] && demux->samples[slot] != sample) {
+		demux->samples[slot] = AMBIGUOUS;
+	}
+}
+
+
+/* Grows the table until count more keys fit at half load, returns -1 if it cannot grow */
+static int
+table_reserve(RNA_DEMUX *demux, size_t count)
+{
+	uint64_t *keys = demux->keys;
+	int      *samples = demux->samples;
+	bool     *exact = demux->exact;
+	size_t   size = demux->table_size;
+	size_t   new_size = size;
+	size_t   slot;
+
+	while(2 * (demux->table_used + count) > new_size) {
+		new_size *= 2;
+	}
+	if(new_size == size) {
+		return 0;
+	}
+
+	demux->keys = s_malloc(new_size * sizeof *demux->keys);
+	demux->samples = s_malloc(new_size * sizeof *demux->samples);
+	demux->exact = s_malloc(new_size * sizeof *demux->exact);
+	if(!demux->keys || !demux->samples || !demux->exact) {
+		s_free(demux->keys);
+		s_free(demux->samples);
+		s_free(demux->exact);
+		demux->keys = keys;
+		demux->samples = samples;
+		demux->exact = exact;
+		return -1;
+	}
+
+	demux->table_size = new_size;
+	for(size_t i = 0; i < demux->table_size; i++) {
+		demux->keys[i] = EMPTY_KEY;
+	}
+
+	for(size_t i = 0; i < size; i++) {
+		if(keys[i] != EMPTY_KEY) {
+			slot = table_find(demux, keys[i]);
+			demux->keys[slot] = keys[i];
+			demux->samples[slot] = samples[i];
+			demux->exact[slot] = exact[i];
+		}
+	}
+
+	s_free(keys);
+	s_free(samples);
+	s_free(exact);
+	return 0;
+}
+
+
+static int
+demux_route(RNA_DEMUX *demux, const RNA_RECORD *record)
+{
+	RNA_RECORD read = *record;
+	RNA_WRITER *output = demux->unmatched;
+	char       *name;
+	size_t     id = 0;
+	int        sample = -1;
+
+	if(record->seq_length >= demux->trim) {
+		sample = rnaf_demux_lookup(demux, record->seq + demux->barcode_offset);
+	}
+
+	if(sample < 0) {
+		demux->unmatched_count++;
+		return output ? rnaf_writer_put(output, record) : 0;
+	}
+
+	demux->counts[sample]++;
+	output = demux->outputs[sample];
+	if(output == NULL) {
+		return 0;
+	}
+
+	/* Remove the barcode and UMI from the read */
+	read.seq += demux->trim;
+	read.seq_length -= demux->trim;
+	if(read.qual) {
+		read.qual += demux->trim < read.qual_length ? demux->trim : read.qual_length;
+		read.qual_length -= demux->trim < read.qual_length ? demux->trim : read.qual_length;
+	}
+
+	/* Append the UMI to the read id, i.e. the name up to the first whitespace */
+	if(demux->umi_length && record->name) {
+		if(demux->name_size < record->name_length + demux->umi_length + 2) {
+			if((name = s_realloc(demux->name, record->name_length + demux->umi_length + 2)) == NULL) {
+				return -1;
+			}
+			demux->name = name;
+			demux->name_size = record->name_length + demux->umi_length + 2;
+		}
+
+		while(id < record->name_length && !isspace((unsigned char)record->name[id])) {
+			id++;
+		}
+
+		memcpy(demux->name, record->name, id);
+		demux->name[id] = '_';
+		memcpy(demux->name + id+1, record->seq + demux->umi_offset, demux->umi_length);
+		memcpy(demux->name + id+1 + demux->umi_length, record->name + id, record->name_length - id);
+		read.name = demux->name;
+		read.name_length = record->name_length + demux->umi_length + 1;
+		read.name[read.name_length] = '\0';
+	}
+
+	return rnaf_writer_put(output, &read);
+}
+
+
+static void *
+demux_read(void *arg)
+{
+	demux_reader *reader = arg;
+	int          next = 0;
+	int          status;
+
+	do {
+		pthread_mutex_lock(&reader->lock);
+		while(reader->filled[next] && !reader->stop) {
+			pthread_cond_wait(&reader->cond, &reader->lock);
+		}
+		if(reader->stop) {
+			pthread_mutex_unlock(&reader->lock);
+			break;
+		}
+		pthread_mutex_unlock(&reader->lock);
+
+		status = rnaf_read_batch(reader->file, reader->batch[next]);
+
+		pthread_mutex_lock(&reader->lock);
+		reader->status[next] = status;
+		reader->filled[next] = true;
+		pthread_cond_broadcast(&reader->cond);
+		pthread_mutex_unlock(&reader->lock);
+
+		next = !next;
+	} while(status > 0);
+
+	return NULL;
+}
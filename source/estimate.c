@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "rnaf.h"
+#include "parser.h"
+#include "cache.h"
+#include "memory_utils.h"
+
+#define ESTIMATE_SAMPLE_SIZE 4194304    /* Default number of bytes of the file sampled */
+#define ESTIMATE_CHUNKS      16         /* Number of parts of the sample whose ratios are measured */
+#define ESTIMATE_CHECK_SIZE  65536      /* Number of characters read between checks of the position */
+#define ESTIMATE_Z           3.0        /* Number of standard errors spanned by the error bounds */
+#define ESTIMATE_ISIZE_SLACK 0.25       /* Relative difference up to which ISIZE matches a sample */
+#define BGZF_HEADER_SIZE     18
+#define BGZF_FOOTER_SIZE     8
+#define GZIP_ISIZE_WRAP      4294967296.0
+
+/* Struct to contain the statistics of the records sampled from the start of a file */
+typedef struct sample_stats {
+	size_t records;
+	size_t bytes;           /* Number of characters up to the end of the last sampled record */
+	double size_sum;        /* Sum of the number of characters of the records */
+	double size_squares;
+	double ratio_sum;       /* Sum of the compression ratios of the parts of the sample */
+	double ratio_squares;
+	size_t chunks;
+	size_t offset;          /* Number of bytes of the file consumed */
+	size_t tell;            /* Number of characters decompressed from them */
+	size_t partial;         /* Number of characters sampled of the record the sample ends in */
+	bool   finished;        /* Whether the end of the file was reached */
+} sample_stats;
+
+/* Struct to contain the state of sample_file() shared with the sink of the sequence lines */
+typedef struct sample_state {
+	RNA_FILE     *rna_file;
+	sample_stats *sample;
+	size_t       sample_size;
+	size_t       checked;       /* Number of characters parsed when the position was last checked */
+	size_t       chunk_offset;  /* Position at which the current part of the sample starts */
+	size_t       chunk_tell;
+	int          status;        /* 1 once sample_size bytes have been consumed, -1 on error */
+} sample_state;
+
+/* Function declarations */
+static int
+sample_file(RNA_FILE *rna_file, sample_stats *sample, size_t sample_size);
+
+static int
+sample_line(void *data, const char *line, size_t length);
+
+static int
+sample_position(sample_state *state);
+
+static int
+bgzf_size(int fd, size_t file_size, size_t *bytes);
+
+static bool
+bgzf_header(const unsigned char *header);
+
+static int
+gzip_size(int fd, size_t file_size, double estimate, size_t *bytes);
+
+static double
+relative_error(double sum, double squares, size_t count);
+
+static uint32_t
+read_le32(const unsigned char *bytes);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+int
+rnaf_estimate(char *filename, RNA_ESTIMATE *estimate, size_t sample_size)
+{
+	RNA_FILE     *rna_file;
+	sample_stats sample = {0};
+	size_t       bytes;
+	double       remaining;
+	double       error;
+	int          direct;
+	int          fd;
+
+	memset(estimate, 0, sizeof *estimate);
+	if((rna_file = rnaf_open(filename)) == NULL) {
+		return -1;
+	}
+	estimate->file_size = rna_file->file_size;
+
+	/* Caches hold the number of records in their header */
+	if(rna_file->cache) {
+		estimate->num_records = cache_count(rna_file->cache);
+		estimate->num_bytes = cache_characters(rna_file->cache);
+		estimate->exact = 1;
+		rnaf_close(rna_file);
+		return 0;
+	}
+
+	if(sample_file(rna_file, &sample, sample_size ? sample_size : ESTIMATE_SAMPLE_SIZE)) {
+		rnaf_close(rna_file);
+		return -1;
+	}
+	direct = gzdirect(rna_file->file);
+	rnaf_close(rna_file);
+
+	estimate->sample_records = sample.records;
+	estimate->record_size = sample.records ? (double)sample.bytes / sample.records : sample.partial;
+	estimate->ratio = sample.offset ? (double)sample.tell / sample.offset : 1;
+
+	if(sample.finished) {
+		estimate->num_records = sample.records;
+		estimate->num_bytes = sample.tell;
+		estimate->exact = 1;
+		return 0;
+	}
+
+	/* Uncompressed files are as large as they read, BGZF blocks and gzip trailers hold the size */
+	bytes = estimate->ratio * estimate->file_size;
+	estimate->bytes_error = direct ? 0 : relative_error(sample.ratio_sum, sample.ratio_squares,
+	                                                    sample.chunks);
+	if(direct) {
+		bytes = estimate->file_size;
+	} else if((fd = open(filename, O_RDONLY)) >= 0) {
+		if(bgzf_size(fd, estimate->file_size, &bytes) == 0 ||
+		   gzip_size(fd, estimate->file_size, estimate->ratio * estimate->file_size, &bytes) == 0) {
+			estimate->bytes_error = 0;
+		}
+		close(fd);
+	}
+	if(bytes < sample.bytes + sample.partial) {
+		bytes = sample.bytes + sample.partial;
+	}
+	estimate->num_bytes = bytes;
+
+	/* Only the records after the sample are extrapolated */
+	remaining = (double)(bytes - sample.bytes) / estimate->record_size;
+	estimate->num_records = sample.records + (size_t)(remaining + 0.5);
+	error = bytes * estimate->bytes_error / estimate->record_size +
+	        remaining * relative_error(sample.size_sum, sample.size_squares, sample.records);
+	estimate->records_error = error / estimate->num_records;
+
+	return 0;
+}
+
+
+double
+rnaf_progress(RNA_FILE *rna_file, size_t *consumed, size_t *total)
+{
+	size_t  position;
+	size_t  count;
+	z_off_t offset;
+
+	/* Caches are read record by record from their mapping */
+	if(rna_file->cache) {
+		count = cache_count(rna_file->cache);
+		position = count ? (double)rna_file->file_size * cache_next(rna_file->cache) / count :
+		                   rna_file->file_size;
+	} else if((offset = gzoffset(rna_file->file)) < 0) {
+		error_message("Failed to get the position in file '%s'.", rna_file->filename);
+		return -1;
+	} else {
+		position = offset;
+	}
+
+	if(position > rna_file->file_size) {
+		position = rna_file->file_size;
+	}
+	if(consumed) {
+		*consumed = position;
+	}
+	if(total) {
+		*total = rna_file->file_size;
+	}
+
+	return rna_file->file_size ? (double)position / rna_file->file_size : 0;
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+/* Reads records until sample_size bytes of the file have been consumed or the file ends, returns 0
+   on success or -1 on error. Records are streamed, so the sample may end inside a long record */
+static int
+sample_file(RNA_FILE *rna_file, sample_stats *sample, size_t sample_size)
+{
+	sample_state state = {rna_file, sample, sample_size, 0, 0, 0, 0};
+	size_t       end;
+	double       size;
+	int          ret;
+
+	while((ret = parser_stream(rna_file, sample_line, &state)) == 1 && !state.status) {
+		end = parser_offset(rna_file);
+		size = (double)(end - sample->bytes);
+		sample->bytes = end;
+		sample->records++;
+		sample->size_sum += size;
+		sample->size_squares += size * size;
+
+		if(end >= state.checked + ESTIMATE_CHECK_SIZE && sample_position(&state)) {
+			break;
+		}
+	}
+
+	if(ret < 0 || state.status < 0 || rna_file->stream_error) {
+		return -1;
+	}
+
+	if(state.status) {
+		sample->partial = parser_offset(rna_file) - sample->bytes;
+		return 0;
+	}
+
+	sample->finished = true;
+	sample->tell = gztell(rna_file->file);
+	sample->offset = rna_file->file_size;
+	return 0;
+}
+
+
+/* Checks the position once every ESTIMATE_CHECK_SIZE characters of a record, returns nonzero to
+   stop reading it */
+static int
+sample_line(void *data, const char *line, size_t length)
+{
+	sample_state *state = data;
+
+	(void)line;
+	(void)length;
+	if(parser_offset(state->rna_file) < state->checked + ESTIMATE_CHECK_SIZE) {
+		return 0;
+	}
+
+	return sample_position(state);
+}
+
+
+/* Records the position in the file, returns 1 once sample_size bytes have been consumed, 0 to go
+   on, or -1 on error */
+static int
+sample_position(sample_state *state)
+{
+	sample_stats *sample = state->sample;
+	double       ratio;
+	z_off_t      offset;
+
+	if((offset = gzoffset(state->rna_file->file)) < 0) {
+		error_message("Failed to get the position in file '%s'.", state->rna_file->filename);
+		return state->status = -1;
+	}
+	sample->offset = offset;
+	sample->tell = gztell(state->rna_file->file);
+	state->checked = parser_offset(state->rna_file);
+
+	/* The ratios of the parts of the sample tell how much the ratio of the file may vary */
+	if(sample->offset > state->chunk_offset &&
+	   sample->offset >= state->chunk_offset + state->sample_size / ESTIMATE_CHUNKS) {
+		ratio = (double)(sample->tell - state->chunk_tell) / (sample->offset - state->chunk_offset);
+		sample->ratio_sum += ratio;
+		sample->ratio_squares += ratio * ratio;
+		sample->chunks++;
+		state->chunk_offset = sample->offset;
+		state->chunk_tell = sample->tell;
+	}
+
+	if(sample->offset >= state->sample_size) {
+		state->status = 1;
+	}
+	return state->status;
+}
+
+
+/* Sums the decompressed sizes in the footers of a BGZF file, returns -1 if the file is not made
+   of BGZF blocks only */
+static int
+bgzf_size(int fd, size_t file_size, size_t *bytes)
+{
+	unsigned char buffer[4 + BGZF_HEADER_SIZE];     /* ISIZE of a block and the next header */
+	unsigned char *header = buffer + 4;
+	size_t        offset = 0;
+	size_t        block;
+	size_t        total = 0;
+	ssize_t       read;
+
+	if(pread(fd, header, BGZF_HEADER_SIZE, 0) != BGZF_HEADER_SIZE) {
+		return -1;
+	}
+
+	/* Every block starts with its size, so only a few bytes of each block are read */
+	while(bgzf_header(header)) {
+		block = (size_t)(header[16] | header[17] << 8) + 1;
+		if(block < BGZF_HEADER_SIZE + BGZF_FOOTER_SIZE || offset + block > file_size ||
+		   (read = pread(fd, buffer, sizeof buffer, offset + block - 4)) < 4) {
+			return -1;
+		}
+
+		total += read_le32(buffer);
+		offset += block;
+		if(offset == file_size) {
+			*bytes = total;
+			return 0;
+		}
+		if((size_t)read < sizeof buffer) {
+			return -1;
+		}
+	}
+
+	return -1;
+}
+
+
+/* Checks whether header starts a gzip member with the BC extra field of BGZF */
+static bool
+bgzf_header(const unsigned char *header)
+{
+	return header[0] == 0x1f && header[1] == 0x8b && header[2] == 8 && (header[3] & 4) &&
+	       header[10] == 6 && header[11] == 0 && header[12] == 'B' && header[13] == 'C' &&
+	       header[14] == 2 && header[15] == 0;
+}
+
+
+/* Reads the decompressed size modulo 2^32 from the gzip trailer, and picks the size closest to
+   the estimate. Returns -1 if they disagree, e.g. because the file holds several gzip members */
+static int
+gzip_size(int fd, size_t file_size, double estimate, size_t *bytes)
+{
+	unsigned char trailer[4];
+	double        wraps;
+	double        size;
+
+	/* Sizes a wrap apart must be told apart by the estimate */
+	if(file_size < 4 || estimate * ESTIMATE_ISIZE_SLACK >= GZIP_ISIZE_WRAP / 2 ||
+	   pread(fd, trailer, sizeof trailer, file_size - 4) != sizeof trailer) {
+		return -1;
+	}
+
+	size = read_le32(trailer);
+	wraps = floor((estimate - size) / GZIP_ISIZE_WRAP + 0.5);
+	size += (wraps > 0 ? wraps : 0) * GZIP_ISIZE_WRAP;
+	if(fabs(size - estimate) > estimate * ESTIMATE_ISIZE_SLACK) {
+		return -1;
+	}
+
+	*bytes = size;
+	return 0;
+}
+
+
+/* Returns ESTIMATE_Z standard errors of the mean of count values relative to the mean, or 1 if
+   there are too few values */
+static double
+relative_error(double sum, double squares, size_t count)
+{
+	double mean;
+	double variance;
+
+	if(count < 2 || sum <= 0) {
+		return 1;
+	}
+
+	mean = sum / count;
+	variance = (squares - sum * mean) / (count-1);
+	return variance > 0 ? ESTIMATE_Z * sqrt(variance / count) / mean : 0;
+}
+
+
+static uint32_t
+read_le32(const unsigned char *bytes)
+{
+	return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 |
+	       (uint32_t)bytes[3] << 24;
+}
@@ -0,0 +1,594 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "rnaf.h"
+#include "cache.h"
+#include "memory_utils.h"
+
+#define INDEX_CAPACITY 1024     /* Initial number of records of the index of a text file */
+#define INDEX_NAMES    65536    /* Initial size of the names of the index of a text file */
+#define EMPTY_SLOT     SIZE_MAX
+
+/* Struct to contain the location of a record in a text file, like a FASTA index (.fai) */
+typedef struct index_entry {
+	uint64_t name;          /* Offset of the name in names */
+	uint64_t name_length;
+	uint64_t offset;        /* Position of the first base in the file */
+	uint64_t length;        /* Number of bases */
+	uint64_t line_bases;    /* Number of bases on every line but the last */
+	uint64_t line_bytes;    /* Number of characters of those lines, including line terminators */
+} index_entry;
+
+struct RNA_INDEX {
+	char        *filename;
+	RNA_CACHE   *cache;         /* Mapped cache, or NULL for a text file read with pread() */
+	int         fd;
+	index_entry *entries;
+	size_t      count;
+	size_t      capacity;
+	char        *names;
+	size_t      names_size;
+	size_t      names_used;
+	bool        named;          /* Whether the records of the text file have names */
+	size_t      *table;         /* Open addressing table of the record ids */
+	size_t      table_size;
+};
+
+struct RNA_CURSOR {
+	const RNA_INDEX *index;
+	char            *buffer;    /* Holds the last fetched region */
+	size_t          buffer_size;
+	uint64_t        exception;  /* Position in the exceptions of a cache */
+};
+
+/* Function declarations */
+static int
+index_scan(RNA_INDEX *index, FILE *file);
+
+static index_entry *
+index_add(RNA_INDEX *index, const char *name, size_t length, uint64_t offset);
+
+static int
+index_hash(RNA_INDEX *index);
+
+static size_t
+table_find(const RNA_INDEX *index, const char *id, size_t length);
+
+static const char *
+index_name(const RNA_INDEX *index, size_t record, size_t *length);
+
+static int
+fetch_text(RNA_CURSOR *cursor, const index_entry *entry, size_t start, size_t length);
+
+static int
+cursor_reserve(RNA_CURSOR *cursor, size_t size);
+
+static size_t
+id_length(const char *name, size_t length);
+
+static uint64_t
+id_hash(const char *id, size_t length);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+RNA_INDEX *
+rnaf_index_open(char *filename)
+{
+	RNA_INDEX     *index;
+	FILE          *file;
+	unsigned char magic[CACHE_MAGIC_LEN] = {0};
+	int           fd;
+
+	if((fd = open(filename, O_RDONLY)) < 0) {
+		error_message("Failed to open file '%s': %s", filename, strerror(errno));
+		return NULL;
+	}
+
+	if((index = s_calloc(1, sizeof *index)) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	index->filename = filename;
+	index->fd = fd;
+
+	if(pread(fd, magic, sizeof magic, 0) < 0) {
+		error_message("Failed to read file '%s': %s", filename, strerror(errno));
+		rnaf_index_close(index);
+		return NULL;
+	}
+
+	/* Caches already hold the offsets of the records, and are shared through their mapping */
+	if(memcmp(magic, CACHE_MAGIC, CACHE_MAGIC_LEN) == 0) {
+		close(index->fd);
+		index->fd = -1;
+		if((index->cache = cache_map(filename)) == NULL) {
+			rnaf_index_close(index);
+			return NULL;
+		}
+		index->count = cache_count(index->cache);
+		if(index_hash(index)) {
+			rnaf_index_close(index);
+			return NULL;
+		}
+		return index;
+	}
+
+	if(magic[0] == 0x1f && magic[1] == 0x8b) {
+		error_message("File '%s' is compressed and cannot be read at random positions. Build a"
+		              " cache of it with rnaf_cache_build() instead.", filename);
+		rnaf_index_close(index);
+		return NULL;
+	}
+
+	if((file = fopen(filename, "rb")) == NULL) {
+		error_message("Failed to open file '%s': %s", filename, strerror(errno));
+		rnaf_index_close(index);
+		return NULL;
+	}
+	if(index_scan(index, file)) {
+		fclose(file);
+		rnaf_index_close(index);
+		return NULL;
+	}
+	fclose(file);
+
+	if(index_hash(index)) {
+		rnaf_index_close(index);
+		return NULL;
+	}
+	return index;
+}
+
+
+RNA_CURSOR *
+rnaf_index_dup(const RNA_INDEX *index)
+{
+	RNA_CURSOR *cursor = s_calloc(1, sizeof *cursor);
+
+	if(cursor == NULL) {
+		return NULL;
+	}
+
+	cursor->index = index;
+	cursor->buffer_size = MAX_SEQ_LENGTH;
+	if((cursor->buffer = s_malloc(cursor->buffer_size * sizeof(char))) == NULL) {
+		s_free(cursor);
+		return NULL;
+	}
+
+	return cursor;
+}
+
+
+size_t
+rnaf_index_count(const RNA_INDEX *index)
+{
+	return index->count;
+}
+
+
+size_t
+rnaf_index_length(const RNA_INDEX *index, size_t record)
+{
+	RNA_RECORD info;
+
+	if(record >= index->count) {
+		return 0;
+	}
+	if(index->cache) {
+		return cache_record(index->cache, record, &info) ? 0 : info.seq_length;
+	}
+	return index->entries[record].length;
+}
+
+
+long
+rnaf_index_find(const RNA_INDEX *index, const char *name)
+{
+	size_t slot;
+
+	if(index->table == NULL) {
+		return -1;
+	}
+
+	slot = table_find(index, name, id_length(name, strlen(name)));
+	return index->table[slot] == EMPTY_SLOT ? -1 : (long)index->table[slot];
+}
+
+
+int
+rnaf_fetch(RNA_CURSOR *cursor, size_t record, size_t start, size_t length, RNA_RECORD *out)
+{
+	const RNA_INDEX *index = cursor->index;
+	RNA_RECORD      info;
+	size_t          seq_length;
+
+	if(record >= index->count) {
+		return 0;
+	}
+	if(index->cache && cache_record(index->cache, record, &info)) {
+		error_message("Corrupted record %zu in cache '%s'.", record, index->filename);
+		return -1;
+	}
+
+	seq_length = index->cache ? info.seq_length : index->entries[record].length;
+	if(start > seq_length) {
+		return 0;
+	}
+	if(length > seq_length - start) {
+		length = seq_length - start;
+	}
+
+	if(cursor_reserve(cursor, length + 1)) {
+		return -1;
+	}
+
+	if(index->cache) {
+		cache_decode(index->cache, record, start, length, cursor->buffer, &cursor->exception);
+	} else if(fetch_text(cursor, &index->entries[record], start, length)) {
+		return -1;
+	}
+
+	out->name = (char *)index_name(index, record, &out->name_length);
+	out->seq = cursor->buffer;
+	out->seq_length = length;
+	out->qual = NULL;
+	out->qual_length = 0;
+
+	return 1;
+}
+
+
+void
+rnaf_cursor_close(RNA_CURSOR *cursor)
+{
+	s_free(cursor->buffer);
+	s_free(cursor);
+}
+
+
+void
+rnaf_index_close(RNA_INDEX *index)
+{
+	if(index->cache) {
+		cache_unmap(index->cache);
+	}
+	if(index->fd >= 0) {
+		close(index->fd);
+	}
+	s_free(index->table);
+	s_free(index->names);
+	s_free(index->entries);
+	s_free(index);
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+/* Records the offset and line layout of every record of a FASTA, FASTQ or sequence-per-line file */
+static int
+index_scan(RNA_INDEX *index, FILE *file)
+{
+	index_entry *entry = NULL;
+	char        *line = NULL;
+	size_t      size = 0;
+	ssize_t     read;
+	size_t      bases;
+	uint64_t    offset = 0;
+	size_t      line_number = 0;
+	char        filetype = '\0';
+	bool        ended = false;  /* Whether the last sequence line of the record has been read */
+	int         status = 0;     /* -1 if the layout is not supported, -2 if memory ran out */
+
+	while(!status && (read = getline(&line, &size, file)) > 0) {
+		for(bases = read; bases && (line[bases-1] == '\n' || line[bases-1] == '\r'); bases--);
+		if(filetype == '\0') {
+			filetype = line[0] == '>' ? 'a' : line[0] == '@' ? 'q' : 'r';
+			index->named = filetype != 'r';
+		}
+
+		switch(filetype) {
+			case 'a':
+				if(line[0] == '>') {
+					if((entry = index_add(index, line+1, bases-1, offset + read)) == NULL) {
+						status = -2;
+					}
+					ended = false;
+				} else if(bases == 0) {
+					ended = true;
+				} else if(entry == NULL || ended || (entry->length && bases > entry->line_bases)) {
+					status = -1;
+				} else {
+					/* Every line but the last must hold the same number of bases */
+					if(entry->length == 0) {
+						entry->line_bases = bases;
+						entry->line_bytes = read;
+					} else if(bases == entry->line_bases && (size_t)read != entry->line_bytes &&
+					          line[read-1] == '\n') {
+						status = -1;
+					}
+					ended = bases < entry->line_bases || line[read-1] != '\n';
+					entry->length += bases;
+				}
+				break;
+
+			case 'q':
+				/* Only FASTQ files with single-line records have a fixed layout */
+				if(line_number % 4 == 0 && bases) {
+					if(line[0] != '@') {
+						status = -1;
+						break;
+					}
+					if((entry = index_add(index, line+1, bases-1, 0)) == NULL) {
+						status = -2;
+					}
+				} else if(line_number % 4 == 1) {
+					entry->offset = offset;
+					entry->length = bases;
+					entry->line_bases = bases;
+					entry->line_bytes = read;
+				} else if(line_number % 4 == 2 && line[0] != '+') {
+					status = -1;
+				}
+				/* Blank lines between records are skipped */
+				line_number += line_number % 4 || bases;
+				break;
+
+			default:
+				if(bases && (entry = index_add(index, NULL, 0, offset)) == NULL) {
+					status = -2;
+				} else if(bases) {
+					entry->length = bases;
+					entry->line_bases = bases;
+					entry->line_bytes = read;
+				}
+				break;
+		}
+
+		if(!status) {
+			offset += read;
+		}
+	}
+	free(line);
+
+	if(!status && ferror(file)) {
+		error_message("Failed to read file '%s': %s", index->filename, strerror(errno));
+		return -1;
+	}
+	if(status == -1) {
+		error_message("Unable to index file '%s' at position %llu: records must be FASTA records"
+		              " whose lines are all as long, except the last, or single-line FASTQ records.",
+		              index->filename, (unsigned long long)offset);
+	}
+
+	return status ? -1 : 0;
+}
+
+
+static index_entry *
+index_add(RNA_INDEX *index, const char *name, size_t length, uint64_t offset)
+{
+	index_entry *entry;
+	char        *names;
+	size_t      size;
+
+	if(index->count == index->capacity) {
+		size = index->capacity ? 2 * index->capacity : INDEX_CAPACITY;
+		if((entry = s_realloc(index->entries, size * sizeof *index->entries)) == NULL) {
+			return NULL;
+		}
+		index->entries = entry;
+		index->capacity = size;
+	}
+
+	if(index->names_used + length + 1 > index->names_size) {
+		size = index->names_size ? index->names_size : INDEX_NAMES;
+		while(index->names_used + length + 1 > size) {
+			size *= 2;
+		}
+		if((names = s_realloc(index->names, size * sizeof(char))) == NULL) {
+			return NULL;
+		}
+		index->names = names;
+		index->names_size = size;
+	}
+
+	entry = &index->entries[index->count++];
+	*entry = (index_entry) {.name = index->names_used, .name_length = length, .offset = offset};
+
+	if(length) {
+		memcpy(index->names + index->names_used, name, length);
+	}
+	index->names[index->names_used + length] = '\0';
+	index->names_used += length + 1;
+
+	return entry;
+}
+
+
+/* Builds the table to look records up by their id, the first of duplicate ids is kept. Returns -1
+   if memory for the table could not be allocated */
+static int
+index_hash(RNA_INDEX *index)
+{
+	const char *name;
+	size_t     length;
+	size_t     slot;
+
+	if(index->count == 0 || index_name(index, 0, &length) == NULL) {
+		return 0;
+	}
+
+	for(index->table_size = 16; index->table_size < 2 * index->count; index->table_size *= 2);
+	if((index->table = s_malloc(index->table_size * sizeof *index->table)) == NULL) {
+		return -1;
+	}
+	for(size_t i = 0; i < index->table_size; i++) {
+		index->table[i] = EMPTY_SLOT;
+	}
+
+	for(size_t i = 0; i < index->count; i++) {
+		if((name = index_name(index, i, &length)) == NULL) {
+			continue;
+		}
+		slot = table_find(index, name, id_length(name, length));
+		if(index->table[slot] == EMPTY_SLOT) {
+			index->table[slot] = i;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Returns the slot of the record with the given id, or the empty slot to insert it into */
+static size_t
+table_find(const RNA_INDEX *index, const char *id, size_t length)
+{
+	const char *name;
+	size_t     name_length;
+	size_t     slot = id_hash(id, length) & (index->table_size-1);
+
+	for(; index->table[slot] != EMPTY_SLOT; slot = (slot+1) & (index->table_size-1)) {
+		name = index_name(index, index->table[slot], &name_length);
+		if(id_length(name, name_length) == length && memcmp(name, id, length) == 0) {
+			break;
+		}
+	}
+
+	return slot;
+}
+
+
+static const char *
+index_name(const RNA_INDEX *index, size_t record, size_t *length)
+{
+	RNA_RECORD info;
+
+	if(index->cache) {
+		if(cache_record(index->cache, record, &info)) {
+			*length = 0;
+			return NULL;
+		}
+		*length = info.name_length;
+		return info.name;
+	}
+
+	*length = index->entries[record].name_length;
+	return index->named ? index->names + index->entries[record].name : NULL;
+}
+
+
+/* Reads a region of a record of a text file, and removes the line terminators within it */
+static int
+fetch_text(RNA_CURSOR *cursor, const index_entry *entry, size_t start, size_t length)
+{
+	uint64_t first;
+	uint64_t last;
+	size_t   span;
+	size_t   used = 0;
+	ssize_t  read;
+
+	if(length == 0) {
+		cursor->buffer[0] = '\0';
+		return 0;
+	}
+
+	first = entry->offset + start / entry->line_bases * entry->line_bytes +
+	        start % entry->line_bases;
+	last = entry->offset + (start+length-1) / entry->line_bases * entry->line_bytes +
+	       (start+length-1) % entry->line_bases;
+	span = last - first + 1;
+
+	if(cursor_reserve(cursor, span + 1)) {
+		return -1;
+	}
+
+	/* pread() leaves the file position alone, so cursors share the file descriptor */
+	while(used < span) {
+		if((read = pread(cursor->index->fd, cursor->buffer + used, span - used, first + used)) <= 0) {
+			error_message("Failed to read file '%s'.", cursor->index->filename);
+			return -1;
+		}
+		used += read;
+	}
+
+	used = 0;
+	for(size_t i = 0; i < span; i++) {
+		if(cursor->buffer[i] != '\n' && cursor->buffer[i] != '\r') {
+			cursor->buffer[used++] = cursor->buffer[i];
+		}
+	}
+	cursor->buffer[used] = '\0';
+
+	if(used != length) {
+		error_message("File '%s' changed since it was indexed.", cursor->index->filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Grows the buffer of a cursor to hold at least size characters, returns -1 if it cannot grow */
+static int
+cursor_reserve(RNA_CURSOR *cursor, size_t size)
+{
+	size_t buffer_size = cursor->buffer_size;
+	char   *buffer;
+
+	if(size <= buffer_size) {
+		return 0;
+	}
+
+	while(size > buffer_size) {
+		buffer_size *= 2;
+	}
+	if((buffer = s_realloc(cursor->buffer, buffer_size * sizeof(char))) == NULL) {
+		return -1;
+	}
+	cursor->buffer = buffer;
+	cursor->buffer_size = buffer_size;
+	return 0;
+}
+
+
+/* Returns the length of the record id, i.e. the name up to the first whitespace */
+static size_t
+id_length(const char *name, size_t length)
+{
+	size_t id = 0;
+
+	while(id < length && !isspace((unsigned char)name[id])) {
+		id++;
+	}
+
+	return id;
+}
+
+
+/* FNV-1a hash of a record id */
+static uint64_t
+id_hash(const char *id, size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for(size_t i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)id[i]) * 1099511628211ULL;
+	}
+
+	return hash;
+}
@@ -1,9 +1,14 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "memory_utils.h"
 
+/* Allocator used by every handle that was not given its own */
+static RNA_ALLOCATOR default_allocator;
+
 void _error_message(const char *format, va_list args);
 
 
@@ -42,36 +47,118 @@ void _warning_message(const char *format, va_list args) {
 }
 
 
+int rnaf_set_allocator(const RNA_ALLOCATOR *allocator) {
+    static const RNA_ALLOCATOR system_allocator = {0};
+
+    if(allocator && a_check(allocator)) {
+        return -1;
+    }
+
+    default_allocator = allocator ? *allocator : system_allocator;
+    return 0;
+}
+
+
+int a_check(const RNA_ALLOCATOR *allocator) {
+    int set = !!allocator->malloc_fn + !!allocator->realloc_fn + !!allocator->free_fn;
+
+    /* Mixing custom functions with the system ones would free blocks with the wrong allocator */
+    if(set != 0 && set != 3) {
+        error_message("An allocator must set either all or none of its malloc, realloc and free "
+                      "functions.");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+const RNA_ALLOCATOR *s_allocator(void) {
+    return &default_allocator;
+}
+
+
 void *s_malloc(size_t mem_size) {
-    void *pointer = malloc(mem_size);
+    return a_malloc(NULL, mem_size);
+}
+
+
+void *s_calloc(size_t count, size_t mem_size) {
+    return a_calloc(NULL, count, mem_size);
+}
+
+
+void *s_realloc(void *ptr, size_t mem_size) {
+    return a_realloc(NULL, ptr, mem_size);
+}
+
+
+void s_free(void *ptr) {
+    a_free(NULL, ptr);
+}
+
+
+void *a_malloc(const RNA_ALLOCATOR *allocator, size_t mem_size) {
+    void *pointer;
+
+    if(allocator == NULL) {
+        allocator = &default_allocator;
+    }
+    pointer = allocator->malloc_fn ? allocator->malloc_fn(allocator->data, mem_size) :
+                                     malloc(mem_size);
 
     if(!pointer && mem_size) {
         error_message("Could not allocate memory.");
-        exit(EXIT_FAILURE);
     }
 
     return pointer;
 }
 
 
-void *s_calloc(size_t count, size_t mem_size) {
-    void *pointer = calloc(count, mem_size);
+void *a_calloc(const RNA_ALLOCATOR *allocator, size_t count, size_t mem_size) {
+    void *pointer;
 
-    if(!pointer && mem_size && count) {
+    if(count && mem_size > SIZE_MAX / count) {
         error_message("Could not allocate memory.");
-        exit(EXIT_FAILURE);
+        return NULL;
+    }
+
+    /* Custom allocators only provide malloc, so the memory is cleared here */
+    if((pointer = a_malloc(allocator, count * mem_size)) != NULL) {
+        memset(pointer, 0, count * mem_size);
     }
 
     return pointer;
 }
 
 
-void *s_realloc(void *ptr, size_t mem_size) {
-    void *new_ptr = realloc(ptr, mem_size);
-    if(new_ptr == NULL) {
+void *a_realloc(const RNA_ALLOCATOR *allocator, void *ptr, size_t mem_size) {
+    void *new_ptr;
+
+    if(allocator == NULL) {
+        allocator = &default_allocator;
+    }
+    new_ptr = allocator->realloc_fn ? allocator->realloc_fn(allocator->data, ptr, mem_size) :
+                                      realloc(ptr, mem_size);
+
+    if(new_ptr == NULL && mem_size) {
         error_message("Failed to reallocate memory");
-        exit(EXIT_FAILURE);
     }
 
     return new_ptr;
 }
+
+
+void a_free(const RNA_ALLOCATOR *allocator, void *ptr) {
+    if(allocator == NULL) {
+        allocator = &default_allocator;
+    }
+
+    if(ptr == NULL) {
+        return;
+    } else if(allocator->free_fn) {
+        allocator->free_fn(allocator->data, ptr);
+    } else {
+        free(ptr);
+    }
+}
@@ -1,6 +1,8 @@
 #ifndef MEMORY_UTILS_H
 #define MEMORY_UTILS_H
 
+#include "rnaf.h"
+
 #define ANSI_COLOR_RED      "\x1b[31m"
 #define ANSI_COLOR_GREEN    "\x1b[32m"
 #define ANSI_COLOR_YELLOW   "\x1b[33m"
@@ -18,35 +20,100 @@
 #define MAX2(A, B)      ((A) > (B) ? (A) : (B))
 
 /**
- *  @brief Safely allocates memory
+ *  @brief Get the default allocator, as set with rnaf_set_allocator()
+ * 
+ *  @return The default allocator, whose functions are NULL for the system allocator
+*/
+const RNA_ALLOCATOR *s_allocator(void);
+
+
+/**
+ *  @brief Check that an allocator sets either all of its functions or none
+ * 
+ *  @param allocator    The allocator to check
+ *  @return             0 if it is valid, or -1 after reporting an error
+*/
+int a_check(const RNA_ALLOCATOR *allocator);
+
+
+/**
+ *  @brief Safely allocates memory with the default allocator
  * 
  *  @param mem_size The size of memory to be allocated in bytes
- *  @return         A pointer to the allocated memory
+ *  @return         A pointer to the allocated memory, or NULL if the allocation failed, which is
+ *                  reported with an error message
 */
 void *s_malloc(size_t mem_size);
 
 
 /**
- *  @brief Safely allocates memory and initializes it to 0
+ *  @brief Safely allocates memory with the default allocator and initializes it to 0
  * 
  *  @param  count       The number of elements to be initialized
  *  @param  mem_size    The size of memory to be allocated for an element in bytes
- *  @return             A pointer to the allocated memory 
+ *  @return             A pointer to the allocated memory, or NULL if the allocation failed
 */
 void *s_calloc(size_t count, size_t mem_size);
 
 
 /**
- *  @brief Safely reallocates memory
+ *  @brief Safely reallocates memory with the default allocator
  * 
  *  @param  ptr         The pointer whose memory will be reallocated
  *  @param  mem_size    The size of memory to be allocated for the pointer in bytes
  * 
- *  @return             A new pointer to the reallocated memory
+ *  @return             A new pointer to the reallocated memory, or NULL if the reallocation
+ *                      failed, in which case ptr is left untouched
 */
 void *s_realloc(void *ptr, size_t mem_size);
 
 
+/**
+ *  @brief Frees memory allocated with the default allocator
+ * 
+ *  @param  ptr         The pointer to free, or NULL
+*/
+void s_free(void *ptr);
+
+
+/**
+ *  @brief Allocates memory with the given allocator, see s_malloc()
+ * 
+ *  @param  allocator   The allocator to use, or NULL for the default allocator
+ *  @param  mem_size    The size of memory to be allocated in bytes
+*/
+void *a_malloc(const RNA_ALLOCATOR *allocator, size_t mem_size);
+
+
+/**
+ *  @brief Allocates memory initialized to 0 with the given allocator, see s_calloc()
+ * 
+ *  @param  allocator   The allocator to use, or NULL for the default allocator
+ *  @param  count       The number of elements to be initialized
+ *  @param  mem_size    The size of memory to be allocated for an element in bytes
+*/
+void *a_calloc(const RNA_ALLOCATOR *allocator, size_t count, size_t mem_size);
+
+
+/**
+ *  @brief Reallocates memory with the given allocator, see s_realloc()
+ * 
+ *  @param  allocator   The allocator the memory was allocated with, or NULL
+ *  @param  ptr         The pointer whose memory will be reallocated
+ *  @param  mem_size    The size of memory to be allocated for the pointer in bytes
+*/
+void *a_realloc(const RNA_ALLOCATOR *allocator, void *ptr, size_t mem_size);
+
+
+/**
+ *  @brief Frees memory with the given allocator
+ * 
+ *  @param  allocator   The allocator the memory was allocated with, or NULL
+ *  @param  ptr         The pointer to free, or NULL
+*/
+void a_free(const RNA_ALLOCATOR *allocator, void *ptr);
+
+
 /**
  *  @brief Print an error message to stderr
  * 
@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "rnaf.h"
+#include "memory_utils.h"
+
+#define PAIR_BATCH_SIZE 4096    /* Number of pairs read by a reader thread at once */
+#define PAIR_SLOTS      2       /* Number of batches a reader thread may read ahead */
+
+/* Struct to contain the batches of mates read by the reader threads */
+typedef struct pair_slot {
+	RNA_BATCH *batch[2];
+	int       status[2];
+	bool      filled[2];
+} pair_slot;
+
+/* Struct to contain the state of a reader thread */
+typedef struct pair_reader {
+	RNA_PAIR  *pair;
+	RNA_FILE  *file;
+	int       mate;         /* Mate read by the thread, or -1 for both mates of interleaved files */
+	pthread_t thread;
+} pair_reader;
+
+struct RNA_PAIR {
+	pair_reader     readers[2];
+	int             num_readers;
+	int             num_threads;    /* Number of reader threads started */
+	pair_slot       slots[PAIR_SLOTS];
+	size_t          read_slot;      /* Slot that is handed out next */
+	bool            holding;        /* Whether read_slot is currently handed out */
+	size_t          position;       /* Next pair of read_slot returned by rnaf_pair_next() */
+	bool            finished;
+	int             finished_status;
+	bool            stop;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+};
+
+/* Function declarations */
+static void *
+pair_read(void *arg);
+
+static int
+read_interleaved(RNA_FILE *rna_file, RNA_BATCH **batch);
+
+static int
+pair_finish(RNA_PAIR *pair, int status);
+
+static bool
+mates_match(const RNA_RECORD *mate1, const RNA_RECORD *mate2);
+
+static size_t
+mate_id_length(const char *name, size_t length);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+RNA_PAIR *
+rnaf_open_pair(char *filename1, char *filename2)
+{
+	RNA_PAIR *pair;
+	RNA_FILE *mate1;
+	RNA_FILE *mate2 = NULL;
+	bool     failed = false;
+
+	if((mate1 = rnaf_open(filename1)) == NULL) {
+		return NULL;
+	}
+	if(filename2 && (mate2 = rnaf_open(filename2)) == NULL) {
+		rnaf_close(mate1);
+		return NULL;
+	}
+
+	if((pair = s_calloc(1, sizeof *pair)) == NULL) {
+		failed = true;
+	}
+	for(int i = 0; !failed && i < PAIR_SLOTS; i++) {
+		pair->slots[i].batch[0] = rnaf_batch_create(PAIR_BATCH_SIZE);
+		pair->slots[i].batch[1] = rnaf_batch_create(PAIR_BATCH_SIZE);
+		failed = pair->slots[i].batch[0] == NULL || pair->slots[i].batch[1] == NULL;
+	}
+
+	if(failed) {
+		for(int i = 0; pair && i < PAIR_SLOTS; i++) {
+			rnaf_batch_free(pair->slots[i].batch[0]);
+			rnaf_batch_free(pair->slots[i].batch[1]);
+		}
+		s_free(pair);
+		rnaf_close(mate1);
+		if(mate2) {
+			rnaf_close(mate2);
+		}
+		return NULL;
+	}
+
+	pthread_mutex_init(&pair->lock, NULL);
+	pthread_cond_init(&pair->cond, NULL);
+
+	/* Interleaved files are read by a single thread that fills both mates */
+	pair->num_readers = mate2 ? 2 : 1;
+	pair->readers[0] = (pair_reader) {.pair = pair, .file = mate1, .mate = mate2 ? 0 : -1};
+	pair->readers[1] = (pair_reader) {.pair = pair, .file = mate2, .mate = 1};
+
+	for(; pair->num_threads < pair->num_readers; pair->num_threads++) {
+		if(pthread_create(&pair->readers[pair->num_threads].thread, NULL, pair_read,
+		                  &pair->readers[pair->num_threads])) {
+			error_message("Failed to start the reader thread of file '%s'.",
+			              pair->readers[pair->num_threads].file->filename);
+			rnaf_close_pair(pair);
+			return NULL;
+		}
+	}
+
+	return pair;
+}
+
+
+int
+rnaf_pair_next(RNA_PAIR *pair, RNA_RECORD *mate1, RNA_RECORD *mate2)
+{
+	RNA_BATCH *batch1;
+	RNA_BATCH *batch2;
+	int       ret;
+
+	if(!pair->holding || pair->position == pair->slots[pair->read_slot].batch[0]->count) {
+		if((ret = rnaf_pair_batch(pair, &batch1, &batch2)) <= 0) {
+			return ret;
+		}
+		pair->position = 0;
+	}
+
+	batch1 = pair->slots[pair->read_slot].batch[0];
+	batch2 = pair->slots[pair->read_slot].batch[1];
+	*mate1 = batch1->records[pair->position];
+	*mate2 = batch2->records[pair->position];
+	pair->position++;
+
+	return 1;
+}
+
+
+int
+rnaf_pair_batch(RNA_PAIR *pair, RNA_BATCH **mate1, RNA_BATCH **mate2)
+{
+	pair_slot *slot;
+
+	if(pair->finished) {
+		return pair->finished_status;
+	}
+
+	pthread_mutex_lock(&pair->lock);
+
+	/* Hand the previous slot back to the reader threads */
+	if(pair->holding) {
+		pair->slots[pair->read_slot].filled[0] = false;
+		pair->slots[pair->read_slot].filled[1] = false;
+		pair->read_slot = (pair->read_slot+1) % PAIR_SLOTS;
+		pair->holding = false;
+		pthread_cond_broadcast(&pair->cond);
+	}
+
+	slot = &pair->slots[pair->read_slot];
+	while(!slot->filled[0] || !slot->filled[1]) {
+		pthread_cond_wait(&pair->cond, &pair->lock);
+	}
+
+	pthread_mutex_unlock(&pair->lock);
+
+	if(slot->status[0] < 0 || slot->status[1] < 0) {
+		return pair_finish(pair, -1);
+	}
+
+	if(slot->status[0] != slot->status[1]) {
+		error_message("Mate files '%s' and '%s' contain a different number of records.",
+		              pair->readers[0].file->filename, pair->readers[1].file->filename);
+		return pair_finish(pair, -1);
+	}
+
+	if(slot->status[0] == 0) {
+		return pair_finish(pair, 0);
+	}
+
+	/* Check the mates are in sync */
+	for(size_t i = 0; i < slot->batch[0]->count; i++) {
+		if(!mates_match(&slot->batch[0]->records[i], &slot->batch[1]->records[i])) {
+			error_message("Mate names '%s' and '%s' do not match.",
+			              slot->batch[0]->records[i].name, slot->batch[1]->records[i].name);
+			return pair_finish(pair, -1);
+		}
+	}
+
+	/* The batches are handed out whole, rnaf_pair_next() continues with the next ones */
+	pair->holding = true;
+	pair->position = slot->batch[0]->count;
+	*mate1 = slot->batch[0];
+	*mate2 = slot->batch[1];
+	return slot->status[0];
+}
+
+
+void
+rnaf_close_pair(RNA_PAIR *pair)
+{
+	pthread_mutex_lock(&pair->lock);
+	pair->stop = true;
+	pthread_cond_broadcast(&pair->cond);
+	pthread_mutex_unlock(&pair->lock);
+
+	for(int i = 0; i < pair->num_threads; i++) {
+		pthread_join(pair->readers[i].thread, NULL);
+	}
+	for(int i = 0; i < pair->num_readers; i++) {
+		rnaf_close(pair->readers[i].file);
+	}
+
+	for(int i = 0; i < PAIR_SLOTS; i++) {
+		rnaf_batch_free(pair->slots[i].batch[0]);
+		rnaf_batch_free(pair->slots[i].batch[1]);
+	}
+
+	pthread_cond_destroy(&pair->cond);
+	pthread_mutex_destroy(&pair->lock);
+	s_free(pair);
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+static void *
+pair_read(void *arg)
+{
+	pair_reader *reader = arg;
+	RNA_PAIR    *pair = reader->pair;
+	pair_slot   *slot;
+	size_t      next = 0;
+	int         first = reader->mate < 0 ? 0 : reader->mate;
+	int         last = reader->mate < 0 ? 1 : reader->mate;
+	int         status;
+
+	do {
+		slot = &pair->slots[next];
+
+		/* Wait until the slot has been handed back */
+		pthread_mutex_lock(&pair->lock);
+		while(slot->filled[first] && !pair->stop) {
+			pthread_cond_wait(&pair->cond, &pair->lock);
+		}
+		if(pair->stop) {
+			pthread_mutex_unlock(&pair->lock);
+			break;
+		}
+		pthread_mutex_unlock(&pair->lock);
+
+		if(reader->mate < 0) {
+			status = read_interleaved(reader->file, slot->batch);
+		} else {
+			status = rnaf_read_batch(reader->file, slot->batch[reader->mate]);
+		}
+
+		pthread_mutex_lock(&pair->lock);
+		for(int mate = first; mate <= last; mate++) {
+			slot->status[mate] = status;
+			slot->filled[mate] = true;
+		}
+		pthread_cond_broadcast(&pair->cond);
+		pthread_mutex_unlock(&pair->lock);
+
+		next = (next+1) % PAIR_SLOTS;
+	} while(status > 0);
+
+	return NULL;
+}
+
+
+static int
+read_interleaved(RNA_FILE *rna_file, RNA_BATCH **batch)
+{
+	RNA_RECORD record;
+	int        ret;
+
+	rnaf_batch_clear(batch[0]);
+	rnaf_batch_clear(batch[1]);
+
+	while(batch[0]->count < batch[0]->capacity) {
+		if((ret = rnaf_next(rna_file, &record)) != 1) {
+			return ret < 0 ? -1 : (int)batch[0]->count;
+		}
+		if(rnaf_batch_add(batch[0], &record) < 0) {
+			return -1;
+		}
+
+		if((ret = rnaf_next(rna_file, &record)) != 1) {
+			if(ret == 0) {
+				error_message("Interleaved file '%s' contains an odd number of records.",
+				              rna_file->filename);
+			}
+			return -1;
+		}
+		if(rnaf_batch_add(batch[1], &record) < 0) {
+			return -1;
+		}
+	}
+
+	return (int)batch[0]->count;
+}
+
+
+static int
+pair_finish(RNA_PAIR *pair, int status)
+{
+	pair->finished = true;
+	pair->finished_status = status;
+	return status;
+}
+
+
+static bool
+mates_match(const RNA_RECORD *mate1, const RNA_RECORD *mate2)
+{
+	size_t length;
+
+	/* Files with sequences per line have no names to compare */
+	if(mate1->name == NULL || mate2->name == NULL) {
+		return true;
+	}
+
+	length = mate_id_length(mate1->name, mate1->name_length);
+	return length == mate_id_length(mate2->name, mate2->name_length) &&
+	       memcmp(mate1->name, mate2->name, length) == 0;
+}
+
+
+/* Returns the length of the read id, i.e. the name up to the first whitespace without /1 or /2 */
+static size_t
+mate_id_length(const char *name, size_t length)
+{
+	size_t id = 0;
+
+	while(id < length && !isspace((unsigned char)name[id])) {
+		id++;
+	}
+
+	if(id >= 2 && name[id-2] == '/' && (name[id-1] == '1' || name[id-1] == '2')) {
+		id -= 2;
+	}
+
+	return id;
+}
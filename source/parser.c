@@ -0,0 +1,769 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "rnaf.h"
+#include "parser.h"
+#include "cache.h"
+#include "string_utils.h"
+#include "memory_utils.h"
+
+/* Function declarations */
+static int
+parse_fasta(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static int
+parse_fasta_crlf(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static int
+parse_fasta_line(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static int
+parse_fasta_line_crlf(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static int
+parse_fastq(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static int
+parse_fastq_crlf(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static int
+parse_fastq_line(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static int
+parse_fastq_line_crlf(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static int
+parse_reads(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static int
+parse_reads_crlf(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static int
+parse_unsupported(RNA_FILE *rna_file, RNA_RECORD *record);
+
+static bool
+sniff_fasta_line(const char *sniff, size_t length);
+
+static bool
+sniff_fastq_line(const char *sniff, size_t length);
+
+static size_t
+stream_fill(RNA_FILE *rna_file);
+
+static int
+stream_lines(RNA_FILE *rna_file, size_t *ends, int count);
+
+static int
+stream_peek(RNA_FILE *rna_file, size_t offset);
+
+static void
+stream_shrink(RNA_FILE *rna_file);
+
+static size_t
+record_append(RNA_FILE *rna_file, size_t offset, const char *str, size_t length);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+int
+parser_select(RNA_FILE *rna_file)
+{
+	char   *sniff;
+	char   *newline;
+	size_t length;
+
+	parser_reset(rna_file);
+	stream_fill(rna_file);
+	if(rna_file->stream_error) {
+		return -1;
+	}
+	if(rna_file->stream_len == 0) {
+		return 0;
+	}
+
+	sniff = rna_file->stream;
+	length = rna_file->stream_len < SNIFF_SIZE ? rna_file->stream_len : SNIFF_SIZE;
+
+	/* Binary sequence caches are read from a memory mapping instead of the stream */
+	if(length >= CACHE_MAGIC_LEN && memcmp(sniff, CACHE_MAGIC, CACHE_MAGIC_LEN) == 0) {
+		parser_reset(rna_file);
+		return cache_open(rna_file);
+	}
+
+	/* Line endings are taken from the first line */
+	newline = memchr(sniff, '\n', length);
+	rna_file->crlf = newline && newline > sniff && newline[-1] == '\r';
+
+	if(IS_CHAR_CLASS(sniff[0], CHAR_NUCLEOTIDE)) {
+		rna_file->filetype = 'r';  /* reads file */
+		rna_file->parse = rna_file->crlf ? parse_reads_crlf : parse_reads;
+
+	} else if(sniff[0] == '@') {
+		rna_file->filetype = 'q';  /* fastq file */
+		if(sniff_fastq_line(sniff, length)) {
+			rna_file->parse = rna_file->crlf ? parse_fastq_line_crlf : parse_fastq_line;
+		} else {
+			rna_file->parse = rna_file->crlf ? parse_fastq_crlf : parse_fastq;
+		}
+
+	} else if(sniff[0] == '>') {
+		rna_file->filetype = 'a';  /* fasta file */
+		if(sniff_fasta_line(sniff, length)) {
+			rna_file->parse = rna_file->crlf ? parse_fasta_line_crlf : parse_fasta_line;
+		} else {
+			rna_file->parse = rna_file->crlf ? parse_fasta_crlf : parse_fasta;
+		}
+
+	} else {
+		rna_file->filetype = '\0'; /* unsupported file type */
+		rna_file->parse = parse_unsupported;
+	}
+
+	/* Reset the file so rnaf_oread() and rnaf_getm() also start from the beginning */
+	gzrewind(rna_file->file);
+	parser_reset(rna_file);
+	return 1;
+}
+
+
+void
+parser_reset(RNA_FILE *rna_file)
+{
+	rna_file->stream_pos = 0;
+	rna_file->stream_len = 0;
+	rna_file->stream_eof = 0;
+	rna_file->stream_error = 0;
+	rna_file->stream[0] = '\0';
+
+	if(rna_file->cache) {
+		cache_rewind(rna_file);
+	}
+}
+
+
+size_t
+parser_offset(RNA_FILE *rna_file)
+{
+	/* Characters read ahead into stream have left zlib but are not parsed yet */
+	return (size_t)gztell(rna_file->file) - (rna_file->stream_len - rna_file->stream_pos);
+}
+
+
+/*##########################################################
+#  Parsers                                                 #
+##########################################################*/
+
+/* Terminates a line in place, returns its length without line terminators */
+static inline size_t
+line_end(char *line, size_t length, const bool crlf)
+{
+	if(crlf && length && line[length-1] == '\r') {
+		length--;
+	}
+	line[length] = '\0';
+	return length;
+}
+
+
+/* Moves the stream past the line ending at offset end */
+static inline void
+stream_consume(RNA_FILE *rna_file, size_t end)
+{
+	rna_file->stream_pos += end + 1;
+	if(rna_file->stream_pos > rna_file->stream_len) {
+		rna_file->stream_pos = rna_file->stream_len;
+	}
+}
+
+
+/* Returns the next line of the stream, or NULL if there are no more lines */
+static inline char *
+stream_line(RNA_FILE *rna_file, size_t *length, const bool crlf)
+{
+	size_t end;
+	char   *line;
+
+	if(!stream_lines(rna_file, &end, 1)) {
+		return NULL;
+	}
+
+	line = rna_file->stream + rna_file->stream_pos;
+	*length = line_end(line, end, crlf);
+	stream_consume(rna_file, end);
+	return line;
+}
+
+
+/* Passes the next line of the stream to sink, in pieces whenever the line does not fit in the
+   stream, so the stream never grows to hold it. sink may be NULL to skip the line. Returns 0 if
+   there are no more lines, 1 if the line was read, or 2 if sink asked to stop */
+static inline int
+stream_sink(RNA_FILE *rna_file, size_t *length, const bool crlf, line_sink sink, void *data)
+{
+	char   *start;
+	char   *newline;
+	size_t count;
+
+	*length = 0;
+	for(;;) {
+		start = rna_file->stream + rna_file->stream_pos;
+		count = rna_file->stream_len - rna_file->stream_pos;
+
+		if((newline = memchr(start, '\n', count)) != NULL || rna_file->stream_eof) {
+			if(newline == NULL && count == 0 && *length == 0) {
+				return 0;
+			}
+			count = newline ? (size_t)(newline - start) : count;
+			stream_consume(rna_file, count);
+			count = line_end(start, count, crlf);
+			*length += count;
+			return sink && sink(data, start, count) ? 2 : 1;
+		}
+
+		/* Pass on what is buffered of the line, except a '\r' that may precede the newline */
+		if(crlf && count && start[count-1] == '\r') {
+			count--;
+		}
+		if(count) {
+			rna_file->stream_pos += count;
+			*length += count;
+			if(sink && sink(data, start, count)) {
+				return 2;
+			}
+		}
+		stream_fill(rna_file);
+	}
+}
+
+
+/* Parses a FASTA record spanning any number of lines */
+static inline int
+fasta_lines(RNA_FILE *rna_file, RNA_RECORD *record, const bool crlf, line_sink sink, void *data)
+{
+	char   *line;
+	size_t length;
+	size_t used;
+	size_t seq_start;
+	int    peek;
+
+	/* Skip empty lines before the header */
+	do {
+		if(!(line = stream_line(rna_file, &length, crlf))) {
+			return 0;
+		}
+	} while(length == 0);
+
+	if(line[0] != '>') {
+		error_message("Expected a FASTA header in file '%s'.", rna_file->filename);
+		return -1;
+	}
+
+	used = sink ? 0 : record_append(rna_file, 0, line+1, length-1);
+	seq_start = sink ? 0 : used+1;
+	used = sink ? 0 : record_append(rna_file, seq_start, NULL, 0);
+
+	/* Every line up to the next header belongs to the sequence */
+	while((peek = stream_peek(rna_file, 0)) != EOF && peek != '>') {
+		if(sink) {
+			if(stream_sink(rna_file, &length, crlf, sink, data) == 2) {
+				return 1;
+			}
+		} else {
+			line = stream_line(rna_file, &length, crlf);
+			used = record_append(rna_file, used, line, length);
+		}
+	}
+
+	if(!sink) {
+		record->name = rna_file->record;
+		record->name_length = seq_start-1;
+		record->seq = rna_file->record + seq_start;
+		record->seq_length = used - seq_start;
+		record->qual = NULL;
+		record->qual_length = 0;
+	}
+
+	return 1;
+}
+
+
+/* Parses a FASTA record with a single sequence line, falls back to fasta_lines() otherwise */
+static inline int
+fasta_line(RNA_FILE *rna_file, RNA_RECORD *record, const bool crlf)
+{
+	size_t ends[2];
+	int    peek;
+	char   *base;
+
+	/* The second line must be a sequence, an empty record is followed by the next header */
+	if(stream_lines(rna_file, ends, 2) < 2 || rna_file->stream[rna_file->stream_pos] != '>' ||
+	   rna_file->stream[rna_file->stream_pos + ends[0]+1] == '>' ||
+	   ((peek = stream_peek(rna_file, ends[1]+1)) != EOF && peek != '>')) {
+		/* Record spans multiple lines, so use the generic parser from now on */
+		rna_file->parse = crlf ? parse_fasta_crlf : parse_fasta;
+		return fasta_lines(rna_file, record, crlf, NULL, NULL);
+	}
+
+	base = rna_file->stream + rna_file->stream_pos;
+	record->name = base+1;
+	record->name_length = line_end(base, ends[0], crlf) - 1;
+	record->seq = base + ends[0]+1;
+	record->seq_length = line_end(record->seq, ends[1]-ends[0]-1, crlf);
+	record->qual = NULL;
+	record->qual_length = 0;
+
+	stream_consume(rna_file, ends[1]);
+	return 1;
+}
+
+
+/* Parses a FASTQ record whose sequence and quality span any number of lines */
+static inline int
+fastq_lines(RNA_FILE *rna_file, RNA_RECORD *record, const bool crlf, line_sink sink, void *data)
+{
+	char   *line;
+	size_t length;
+	size_t used;
+	size_t seq_start;
+	size_t seq_length = 0;
+	size_t qual_start;
+	size_t qual_length = 0;
+	int    peek;
+
+	/* Skip empty lines before the header */
+	do {
+		if(!(line = stream_line(rna_file, &length, crlf))) {
+			return 0;
+		}
+	} while(length == 0);
+
+	if(line[0] != '@') {
+		error_message("Expected a FASTQ header in file '%s'.", rna_file->filename);
+		return -1;
+	}
+
+	used = sink ? 0 : record_append(rna_file, 0, line+1, length-1);
+	seq_start = sink ? 0 : used+1;
+	used = sink ? 0 : record_append(rna_file, seq_start, NULL, 0);
+
+	/* Every line up to the separator belongs to the sequence */
+	while((peek = stream_peek(rna_file, 0)) != EOF && peek != '+') {
+		if(sink) {
+			if(stream_sink(rna_file, &length, crlf, sink, data) == 2) {
+				return 1;
+			}
+		} else {
+			line = stream_line(rna_file, &length, crlf);
+			used = record_append(rna_file, used, line, length);
+		}
+		seq_length += length;
+	}
+
+	if(!stream_line(rna_file, &length, crlf)) {
+		error_message("Truncated FASTQ record in file '%s'.", rna_file->filename);
+		return -1;
+	}
+
+	/* Quality has as many characters as the sequence, so it may start with '@' */
+	qual_start = used+1;
+	used = sink ? 0 : record_append(rna_file, qual_start, NULL, 0);
+	while(qual_length < seq_length) {
+		if(sink ? !stream_sink(rna_file, &length, crlf, NULL, NULL) :
+		          !(line = stream_line(rna_file, &length, crlf))) {
+			error_message("Truncated FASTQ record in file '%s'.", rna_file->filename);
+			return -1;
+		}
+		qual_length += length;
+		if(!sink) {
+			used = record_append(rna_file, used, line, length);
+		}
+	}
+
+	if(!sink) {
+		record->name = rna_file->record;
+		record->name_length = seq_start-1;
+		record->seq = rna_file->record + seq_start;
+		record->seq_length = seq_length;
+		record->qual = rna_file->record + qual_start;
+		record->qual_length = qual_length;
+	}
+
+	return 1;
+}
+
+
+/* Parses a 4-line FASTQ record, falls back to fastq_lines() otherwise */
+static inline int
+fastq_line(RNA_FILE *rna_file, RNA_RECORD *record, const bool crlf)
+{
+	size_t ends[4];
+	char   *base;
+
+	if(stream_lines(rna_file, ends, 4) < 4) {
+		rna_file->parse = crlf ? parse_fastq_crlf : parse_fastq;
+		return fastq_lines(rna_file, record, crlf, NULL, NULL);
+	}
+
+	base = rna_file->stream + rna_file->stream_pos;
+	if(base[0] != '@' || base[ends[1]+1] != '+' ||
+	   ends[1]-ends[0] != ends[3]-ends[2]) {
+		/* Record spans multiple lines, so use the generic parser from now on */
+		rna_file->parse = crlf ? parse_fastq_crlf : parse_fastq;
+		return fastq_lines(rna_file, record, crlf, NULL, NULL);
+	}
+
+	record->name = base+1;
+	record->name_length = line_end(base, ends[0], crlf) - 1;
+	record->seq = base + ends[0]+1;
+	record->seq_length = line_end(record->seq, ends[1]-ends[0]-1, crlf);
+	record->qual = base + ends[2]+1;
+	record->qual_length = line_end(record->qual, ends[3]-ends[2]-1, crlf);
+
+	stream_consume(rna_file, ends[3]);
+	return 1;
+}
+
+
+/* Parses a record of a file containing one sequence per line */
+static inline int
+reads_line(RNA_FILE *rna_file, RNA_RECORD *record, const bool crlf, line_sink sink, void *data)
+{
+	char   *line;
+	size_t length;
+	int    peek;
+
+	if(sink) {
+		/* Skip empty lines without reading the sequence into the stream */
+		while((peek = stream_peek(rna_file, 0)) == '\n' ||
+		      (crlf && peek == '\r' && stream_peek(rna_file, 1) == '\n')) {
+			stream_consume(rna_file, peek == '\n' ? 0 : 1);
+		}
+		return stream_sink(rna_file, &length, crlf, sink, data) ? 1 : 0;
+	}
+
+	/* Skip empty lines */
+	do {
+		if(!(line = stream_line(rna_file, &length, crlf))) {
+			return 0;
+		}
+	} while(length == 0);
+
+	record->name = NULL;
+	record->name_length = 0;
+	record->seq = line;
+	record->seq_length = length;
+	record->qual = NULL;
+	record->qual_length = 0;
+	return 1;
+}
+
+
+int
+parser_stream(RNA_FILE *rna_file, line_sink sink, void *data)
+{
+	int ret;
+
+	if(rna_file->cache) {
+		return cache_stream(rna_file, sink, data);
+	}
+
+	switch(rna_file->filetype) {
+		case 'a': ret = fasta_lines(rna_file, NULL, rna_file->crlf, sink, data); break;
+		case 'q': ret = fastq_lines(rna_file, NULL, rna_file->crlf, sink, data); break;
+		case 'r': ret = reads_line(rna_file, NULL, rna_file->crlf, sink, data); break;
+		default:  return parse_unsupported(rna_file, NULL);
+	}
+
+	/* Records read whole before may have grown the stream */
+	stream_shrink(rna_file);
+	return ret;
+}
+
+
+static int
+parse_fasta(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	return fasta_lines(rna_file, record, false, NULL, NULL);
+}
+
+
+static int
+parse_fasta_crlf(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	return fasta_lines(rna_file, record, true, NULL, NULL);
+}
+
+
+static int
+parse_fasta_line(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	return fasta_line(rna_file, record, false);
+}
+
+
+static int
+parse_fasta_line_crlf(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	return fasta_line(rna_file, record, true);
+}
+
+
+static int
+parse_fastq(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	return fastq_lines(rna_file, record, false, NULL, NULL);
+}
+
+
+static int
+parse_fastq_crlf(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	return fastq_lines(rna_file, record, true, NULL, NULL);
+}
+
+
+static int
+parse_fastq_line(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	return fastq_line(rna_file, record, false);
+}
+
+
+static int
+parse_fastq_line_crlf(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	return fastq_line(rna_file, record, true);
+}
+
+
+static int
+parse_reads(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	return reads_line(rna_file, record, false, NULL, NULL);
+}
+
+
+static int
+parse_reads_crlf(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	return reads_line(rna_file, record, true, NULL, NULL);
+}
+
+
+static int
+parse_unsupported(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	(void)record;
+
+	error_message("Unable to read sequence from file '%s'.\nCurrent supported file types are:"
+	" FASTA, FASTQ, and files containing sequences per line.", rna_file->filename);
+	return -1;
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+static bool
+sniff_fasta_line(const char *sniff, size_t length)
+{
+	const char *line = sniff;
+	const char *end;
+	int        lines = 0;      /* Number of lines following the current header */
+	int        records = 0;
+
+	/* Only complete lines are inspected, every header must be followed by exactly one line */
+	while((end = memchr(line, '\n', length - (line-sniff))) != NULL) {
+		if(line[0] == '>') {
+			if(records && lines != 1) {
+				return false;
+			}
+			records++;
+			lines = 0;
+		} else if(++lines > 1) {
+			return false;
+		}
+		line = end+1;
+	}
+
+	return records > 1 || (records == 1 && lines == 1);
+}
+
+
+static bool
+sniff_fastq_line(const char *sniff, size_t length)
+{
+	const char *line[4];
+	const char *end[4];
+	const char *next = sniff;
+	int        records = 0;
+
+	/* Only complete records are inspected, every record must span exactly four lines */
+	while(1) {
+		for(int i = 0; i < 4; i++) {
+			line[i] = next;
+			end[i] = memchr(next, '\n', length - (next-sniff));
+			if(end[i] == NULL) {
+				return records > 0;
+			}
+			next = end[i]+1;
+		}
+
+		if(line[0][0] != '@' || line[2][0] != '+' || end[1]-line[1] != end[3]-line[3]) {
+			return false;
+		}
+		records++;
+	}
+}
+
+
+static size_t
+stream_fill(RNA_FILE *rna_file)
+{
+	char *stream;
+	int  read;
+
+	/* Move the unparsed characters to the beginning of the buffer */
+	if(rna_file->stream_pos) {
+		memmove(rna_file->stream, rna_file->stream + rna_file->stream_pos,
+		        (rna_file->stream_len - rna_file->stream_pos) * sizeof(char));
+		rna_file->stream_len -= rna_file->stream_pos;
+		rna_file->stream_pos = 0;
+	}
+
+	/* If buffer isn't large enough to store the line, grow it */
+	if(rna_file->stream_len + 1 >= rna_file->stream_size) {
+		if((stream = a_realloc(&rna_file->allocator, rna_file->stream,
+		                       2 * rna_file->stream_size * sizeof(char))) == NULL) {
+			/* Stop reading, the parsers report the error once they run out of lines */
+			rna_file->stream_eof = 1;
+			rna_file->stream_error = 1;
+			return 0;
+		}
+		rna_file->stream = stream;
+		rna_file->stream_size *= 2;
+	}
+
+	/* Always leave space to terminate the last line of the file */
+	read = gzread(rna_file->file, rna_file->stream + rna_file->stream_len,
+	              rna_file->stream_size - rna_file->stream_len - 1);
+	if(read <= 0) {
+		if(read < 0) {
+			error_message("Failed to read file '%s'.", rna_file->filename);
+			rna_file->stream_error = 1;
+		}
+		rna_file->stream_eof = 1;
+		read = 0;
+	}
+
+	rna_file->stream_len += read;
+	rna_file->stream[rna_file->stream_len] = '\0';
+	return read;
+}
+
+
+/* Finds the ends of the next count lines, as offsets from stream_pos */
+static int
+stream_lines(RNA_FILE *rna_file, size_t *ends, int count)
+{
+	size_t from = 0;
+	int    found = 0;
+	char   *start;
+	char   *newline;
+
+	while(found < count) {
+		start = rna_file->stream + rna_file->stream_pos;
+		newline = memchr(start + from, '\n', rna_file->stream_len - rna_file->stream_pos - from);
+
+		if(newline) {
+			ends[found++] = newline - start;
+			from = newline - start + 1;
+
+		} else if(rna_file->stream_eof) {
+			/* The last line of the file may not end with a newline */
+			if(rna_file->stream_pos + from < rna_file->stream_len) {
+				ends[found++] = rna_file->stream_len - rna_file->stream_pos;
+			}
+			break;
+
+		} else {
+			stream_fill(rna_file);
+		}
+	}
+
+	return found;
+}
+
+
+/* Returns the character at offset from stream_pos, or EOF */
+static int
+stream_peek(RNA_FILE *rna_file, size_t offset)
+{
+	while(rna_file->stream_pos + offset >= rna_file->stream_len) {
+		if(rna_file->stream_eof) {
+			return EOF;
+		}
+		stream_fill(rna_file);
+	}
+
+	return (unsigned char)rna_file->stream[rna_file->stream_pos + offset];
+}
+
+
+/* Returns the stream to its initial size once the unparsed characters fit in it again */
+static void
+stream_shrink(RNA_FILE *rna_file)
+{
+	size_t count = rna_file->stream_len - rna_file->stream_pos;
+	char   *stream;
+
+	if(rna_file->stream_size <= STREAM_SIZE || count >= STREAM_SIZE) {
+		return;
+	}
+
+	memmove(rna_file->stream, rna_file->stream + rna_file->stream_pos, count * sizeof(char));
+	rna_file->stream_pos = 0;
+	rna_file->stream_len = count;
+	rna_file->stream[count] = '\0';
+
+	/* Keep the larger buffer if it cannot be resized */
+	stream = a_realloc(&rna_file->allocator, rna_file->stream, STREAM_SIZE * sizeof(char));
+	if(stream != NULL) {
+		rna_file->stream = stream;
+		rna_file->stream_size = STREAM_SIZE;
+	}
+}
+
+
+/* Copies str to offset of the record buffer and terminates it, returns the end of str. If the
+   buffer cannot grow, stream_error is set and nothing is copied */
+static size_t
+record_append(RNA_FILE *rna_file, size_t offset, const char *str, size_t length)
+{
+	size_t size = rna_file->record_size;
+	char   *record;
+
+	if(offset + length + 1 > size) {
+		while(offset + length + 1 > size) {
+			size *= 2;
+		}
+		if((record = a_realloc(&rna_file->allocator, rna_file->record, size * sizeof(char))) == NULL) {
+			rna_file->stream_error = 1;
+			return offset;
+		}
+		rna_file->record = record;
+		rna_file->record_size = size;
+	}
+
+	if(length) {
+		memcpy(rna_file->record + offset, str, length * sizeof(char));
+	}
+	rna_file->record[offset + length] = '\0';
+	return offset + length;
+}
@@ -0,0 +1,73 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "rnaf.h"
+
+#define STREAM_SIZE 131072  /* Initial size of the read-ahead buffer of the parsers */
+#define SNIFF_SIZE  16384   /* Number of characters inspected to select the parser */
+
+/**
+ *  @brief Receives every sequence line of a record streamed with parser_stream().
+ *
+ *  Lines longer than the stream are passed on in several pieces.
+ *
+ *  @param data     User pointer passed to parser_stream()
+ *  @param line     The sequence line or a piece of it, without line terminators and not
+ *                  null-terminated
+ *  @param length   The number of characters in line
+ *
+ *  @return 0 to keep reading the record, or nonzero to stop. The rest of the record is then left
+ *          unread, so the file may only be rewound or closed afterwards
+*/
+typedef int (*line_sink)(void *data, const char *line, size_t length);
+
+
+/**
+ *  @brief Select the parser used by rnaf_next() for the format of rna_file.
+ *
+ *  The first SNIFF_SIZE characters of the file are inspected to detect the file format (FASTA,
+ *  FASTQ, or sequences per line), whether every record spans a single line, and whether lines
+ *  end with "\r\n". The file is rewound afterwards.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened file
+ *
+ *  @return 1 if the file contains data, 0 if the file is empty, or -1 on error
+*/
+int parser_select(RNA_FILE *rna_file);
+
+
+/**
+ *  @brief Discard the read-ahead buffer, e.g. after the file has been rewound.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened file
+*/
+void parser_reset(RNA_FILE *rna_file);
+
+
+/**
+ *  @brief Get the number of decompressed characters of the file parsed so far.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened file
+ *
+ *  @return The position after the last record returned by rnaf_next()
+*/
+size_t parser_offset(RNA_FILE *rna_file);
+
+
+/**
+ *  @brief Read the next record, passing its sequence lines to sink instead of storing them.
+ *
+ *  Sequence lines are passed to sink in pieces of at most the stream, which is returned to
+ *  STREAM_SIZE afterwards, so records and lines of any length are read in constant memory. Only
+ *  headers are held whole.
+ *
+ *  @param rna_file A pointer to the RNA_FILE struct representing the opened file
+ *  @param sink     Function called with every sequence line of the record
+ *  @param data     User pointer forwarded to sink
+ *
+ *  @return 1 if a record was read or sink stopped it, 0 if there are no more records, or -1 on
+ *          error
+*/
+int parser_stream(RNA_FILE *rna_file, line_sink sink, void *data);
+
+#endif // PARSER_H
@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "rnaf.h"
+#include "memory_utils.h"
+
+#define PROFILE_BATCH_SIZE 4096     /* Number of records handed to a worker thread at once */
+#define PROFILE_FLUSH      255      /* Number of reads the 8-bit tallies can count */
+#define PROFILE_TALLIED    5        /* A, C, G, T/U and N are tallied, other bases are derived */
+#define PROFILE_GC_BINS    101
+
+/* Indices into the tallies plus one, 0 for every other character */
+static const unsigned char base_code[256] = {
+	['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4, ['U'] = 4, ['N'] = 5,
+	['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4, ['u'] = 4, ['n'] = 5,
+};
+
+/* States of a batch while it is profiled */
+enum slot_state {SLOT_FREE, SLOT_FILLED, SLOT_RUNNING};
+
+/* Struct to contain the partial profile of a thread */
+typedef struct profile_counts {
+	unsigned char *tally[PROFILE_TALLIED];  /* 8-bit counts per position of the last reads */
+	size_t        *counts[PROFILE_TALLIED]; /* Counts per position, tallies are added on flush */
+	size_t        *lengths;                 /* Number of reads per length, up to capacity */
+	size_t        capacity;                 /* Number of positions, a multiple of 16 */
+	size_t        pending;                  /* Number of reads in the tallies */
+	size_t        overflow[PROFILE_TALLIED];  /* Counts of the positions past the capacity */
+	size_t        overflow_bases;           /* Number of characters at those positions */
+	size_t        length_bins[RNAF_LENGTH_BINS];  /* Reads longer than the capacity */
+	size_t        num_reads;
+	size_t        num_bases;
+	size_t        min_length;
+	size_t        max_length;
+	size_t        gc[PROFILE_GC_BINS];
+	bool          failed;                   /* Whether memory for a read could not be allocated */
+} profile_counts;
+
+/* Struct to contain the batches shared by the reading and the worker threads */
+typedef struct profile_pool {
+	RNA_BATCH       **batches;
+	enum slot_state *states;
+	size_t          num_slots;
+	bool            stop;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+} profile_pool;
+
+/* Struct to contain the state of a worker thread */
+typedef struct profile_worker {
+	profile_pool   *pool;
+	profile_counts counts;
+	pthread_t      thread;
+} profile_worker;
+
+/* Function declarations */
+static int
+profile_fill(RNA_FILE *rna_file, RNA_BATCH *batch, size_t limit);
+
+static void *
+profile_work(void *arg);
+
+static int
+profile_batch(profile_counts *counts, const RNA_BATCH *batch);
+
+static void
+profile_read(profile_counts *counts, const char *seq, size_t length);
+
+static int
+counts_grow(profile_counts *counts, size_t length);
+
+static void
+counts_flush(profile_counts *counts);
+
+static int
+counts_add(profile_counts *counts, profile_counts *other);
+
+static int
+counts_merge(RNA_PROFILE *profile, profile_counts *counts);
+
+static void
+counts_free(profile_counts *counts);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+long
+rnaf_profile(RNA_FILE *rna_file, RNA_PROFILE *profile, size_t max_reads, int nthreads)
+{
+	profile_pool   pool = {0};
+	profile_worker *workers = NULL;
+	profile_counts counts = {0};
+	RNA_BATCH      *batch;
+	size_t         remaining = max_reads ? max_reads : (size_t)-1;
+	size_t         slot = 0;
+	int            num_workers = nthreads > 0 ? nthreads : 0;
+	int            status = 1;
+
+	memset(profile, 0, sizeof *profile);
+
+	/* Keep every worker busy while the next batch is read */
+	pool.num_slots = num_workers ? 2 * num_workers : 1;
+	pool.batches = s_calloc(pool.num_slots, sizeof *pool.batches);
+	pool.states = s_calloc(pool.num_slots, sizeof *pool.states);
+	if(num_workers && (workers = s_calloc(num_workers, sizeof *workers)) == NULL) {
+		status = -1;
+	}
+	for(size_t i = 0; pool.batches && i < pool.num_slots; i++) {
+		if((pool.batches[i] = rnaf_batch_create(PROFILE_BATCH_SIZE)) == NULL) {
+			status = -1;
+		}
+	}
+
+	if(status < 0 || pool.batches == NULL || pool.states == NULL) {
+		for(size_t i = 0; pool.batches && i < pool.num_slots; i++) {
+			rnaf_batch_free(pool.batches[i]);
+		}
+		s_free(pool.states);
+		s_free(pool.batches);
+		s_free(workers);
+		return -1;
+	}
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	for(int i = 0; i < num_workers; i++) {
+		workers[i].pool = &pool;
+		if(pthread_create(&workers[i].thread, NULL, profile_work, &workers[i])) {
+			error_message("Failed to start a worker thread of the profile.");
+
+			/* Only the threads started are stopped and joined below */
+			num_workers = i;
+			status = -1;
+		}
+	}
+
+	/* Decompress and parse on the calling thread, count on the workers */
+	while(remaining && status > 0) {
+		pthread_mutex_lock(&pool.lock);
+		while(pool.states[slot] != SLOT_FREE) {
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		}
+		pthread_mutex_unlock(&pool.lock);
+
+		batch = pool.batches[slot];
+		if((status = profile_fill(rna_file, batch, remaining)) <= 0) {
+			break;
+		}
+		remaining -= status;
+
+		if(num_workers == 0) {
+			if(profile_batch(&counts, batch)) {
+				status = -1;
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&pool.lock);
+		pool.states[slot] = SLOT_FILLED;
+		pthread_cond_broadcast(&pool.cond);
+		pthread_mutex_unlock(&pool.lock);
+		slot = (slot+1) % pool.num_slots;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.stop = true;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+	for(int i = 0; i < num_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	for(int i = 0; i < num_workers; i++) {
+		if(counts_add(&counts, &workers[i].counts)) {
+			status = -1;
+		}
+		counts_free(&workers[i].counts);
+	}
+	if(status >= 0 && counts_merge(profile, &counts)) {
+		rnaf_profile_free(profile);
+		status = -1;
+	}
+	counts_free(&counts);
+	for(size_t i = 0; i < pool.num_slots; i++) {
+		rnaf_batch_free(pool.batches[i]);
+	}
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.lock);
+	s_free(pool.states);
+	s_free(pool.batches);
+	s_free(workers);
+
+	return status < 0 ? -1 : (long)profile->num_reads;
+}
+
+
+void
+rnaf_profile_free(RNA_PROFILE *profile)
+{
+	for(int i = 0; i < RNAF_NUM_BASES; i++) {
+		s_free(profile->position_counts[i]);
+		profile->position_counts[i] = NULL;
+	}
+	s_free(profile->length_counts);
+	profile->length_counts = NULL;
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+/* Fills the batch with up to limit records, like rnaf_read_batch() */
+static int
+profile_fill(RNA_FILE *rna_file, RNA_BATCH *batch, size_t limit)
+{
+	RNA_RECORD record;
+	int        ret = 0;
+
+	rnaf_batch_clear(batch);
+	while(batch->count < batch->capacity && batch->count < limit &&
+	      (ret = rnaf_next(rna_file, &record)) == 1) {
+		if(rnaf_batch_add(batch, &record) < 0) {
+			return -1;
+		}
+	}
+
+	return ret < 0 ? -1 : (int)batch->count;
+}
+
+
+static void *
+profile_work(void *arg)
+{
+	profile_worker *worker = arg;
+	profile_pool   *pool = worker->pool;
+	size_t         slot;
+
+	pthread_mutex_lock(&pool->lock);
+	while(1) {
+		/* Batches may be counted in any order */
+		for(slot = 0; slot < pool->num_slots && pool->states[slot] != SLOT_FILLED; slot++);
+
+		if(slot == pool->num_slots) {
+			if(pool->stop) {
+				break;
+			}
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+
+		pool->states[slot] = SLOT_RUNNING;
+		pthread_mutex_unlock(&pool->lock);
+
+		profile_batch(&worker->counts, pool->batches[slot]);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->states[slot] = SLOT_FREE;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+
+/* Counts the reads of a batch, returns -1 if the counts cannot grow to fit a read */
+static int
+profile_batch(profile_counts *counts, const RNA_BATCH *batch)
+{
+	if(counts->failed) {
+		return -1;
+	}
+
+	for(size_t i = 0; i < batch->count; i++) {
+		if(counts->lengths == NULL || (batch->records[i].seq_length > counts->capacity &&
+		                               counts->capacity < RNAF_PROFILE_POSITIONS)) {
+			if(counts_grow(counts, batch->records[i].seq_length)) {
+				counts->failed = true;
+				return -1;
+			}
+		}
+		profile_read(counts, batch->records[i].seq, batch->records[i].seq_length);
+
+		if(++counts->pending == PROFILE_FLUSH) {
+			counts_flush(counts);
+		}
+	}
+
+	return 0;
+}
+
+
+/* Tallies the bases of a read per position up to the capacity, and its GC content */
+static void
+profile_read(profile_counts *counts, const char *seq, size_t length)
+{
+	unsigned char **tally = counts->tally;
+	size_t        tallied = length < counts->capacity ? length : counts->capacity;
+	size_t        gc = 0;
+	size_t        i = 0;
+	int           bin = 0;
+	unsigned char code;
+
+#if defined(__SSE2__)
+	/* Tally 16 positions at once, subtracting the all-ones masks of the matching bases */
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i       gc_sum = _mm_setzero_si128();
+
+	for(; i + 16 <= tallied; i += 16) {
+		__m128i c = _mm_or_si128(_mm_loadu_si128((const __m128i *)(seq + i)), lower);
+		__m128i mask[PROFILE_TALLIED];
+
+		mask[0] = _mm_cmpeq_epi8(c, _mm_set1_epi8('a'));
+		mask[1] = _mm_cmpeq_epi8(c, _mm_set1_epi8('c'));
+		mask[2] = _mm_cmpeq_epi8(c, _mm_set1_epi8('g'));
+		mask[3] = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('t')),
+		                       _mm_cmpeq_epi8(c, _mm_set1_epi8('u')));
+		mask[4] = _mm_cmpeq_epi8(c, _mm_set1_epi8('n'));
+
+		for(int b = 0; b < PROFILE_TALLIED; b++) {
+			__m128i t = _mm_loadu_si128((const __m128i *)(tally[b] + i));
+			_mm_storeu_si128((__m128i *)(tally[b] + i), _mm_sub_epi8(t, mask[b]));
+		}
+
+		gc_sum = _mm_add_epi64(gc_sum, _mm_sad_epu8(_mm_and_si128(_mm_or_si128(mask[1], mask[2]),
+		                                                          one), _mm_setzero_si128()));
+	}
+	gc += (size_t)_mm_cvtsi128_si32(gc_sum) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(gc_sum, 8));
+#endif
+
+	for(; i < tallied; i++) {
+		if((code = base_code[(unsigned char)seq[i]])) {
+			tally[code-1][i]++;
+			gc += code == 2 || code == 3;
+		}
+	}
+
+	/* Positions past RNAF_PROFILE_POSITIONS share a single count per base */
+	for(; i < length; i++) {
+		if((code = base_code[(unsigned char)seq[i]])) {
+			counts->overflow[code-1]++;
+			gc += code == 2 || code == 3;
+		}
+	}
+
+	if(length <= counts->capacity) {
+		counts->lengths[length]++;
+	} else {
+		while(length >> (bin+1)) {
+			bin++;
+		}
+		counts->length_bins[bin]++;
+		counts->overflow_bases += length - counts->capacity;
+	}
+	if(counts->num_reads == 0 || length < counts->min_length) {
+		counts->min_length = length;
+	}
+	if(length > counts->max_length) {
+		counts->max_length = length;
+	}
+	counts->num_reads++;
+	counts->num_bases += length;
+	if(length) {
+		counts->gc[(gc * 100 + length/2) / length]++;
+	}
+}
+
+
+/* Makes room for reads of the given length up to RNAF_PROFILE_POSITIONS, flushing the tallies
+   first. Returns -1 if memory could not be allocated, which leaves the capacity as it was */
+static int
+counts_grow(profile_counts *counts, size_t length)
+{
+	size_t        capacity = counts->capacity ? counts->capacity : 16;
+	unsigned char *tally;
+	size_t        *sums;
+
+	counts_flush(counts);
+	while(capacity < length && capacity < RNAF_PROFILE_POSITIONS) {
+		capacity *= 2;
+	}
+
+	for(int b = 0; b < PROFILE_TALLIED; b++) {
+		if((tally = s_realloc(counts->tally[b], capacity)) == NULL) {
+			return -1;
+		}
+		counts->tally[b] = tally;
+		memset(counts->tally[b] + counts->capacity, 0, capacity - counts->capacity);
+		if((sums = s_realloc(counts->counts[b], capacity * sizeof(size_t))) == NULL) {
+			return -1;
+		}
+		counts->counts[b] = sums;
+		memset(counts->counts[b] + counts->capacity, 0,
+		       (capacity - counts->capacity) * sizeof(size_t));
+	}
+
+	/* Reads of length 0 are counted too */
+	if((sums = s_realloc(counts->lengths, (capacity+1) * sizeof(size_t))) == NULL) {
+		return -1;
+	}
+	counts->lengths = sums;
+	memset(counts->lengths + (counts->capacity ? counts->capacity+1 : 0), 0,
+	       (capacity - counts->capacity + (counts->capacity ? 0 : 1)) * sizeof(size_t));
+	counts->capacity = capacity;
+	return 0;
+}
+
+
+/* Adds the 8-bit tallies to the counts before they overflow */
+static void
+counts_flush(profile_counts *counts)
+{
+	for(int b = 0; b < PROFILE_TALLIED; b++) {
+		for(size_t p = 0; p < counts->capacity; p++) {
+			counts->counts[b][p] += counts->tally[b][p];
+		}
+		if(counts->capacity) {
+			memset(counts->tally[b], 0, counts->capacity);
+		}
+	}
+	counts->pending = 0;
+}
+
+
+/* Adds the partial profile of another thread to counts, returns -1 if either is incomplete */
+static int
+counts_add(profile_counts *counts, profile_counts *other)
+{
+	if(other->failed) {
+		return -1;
+	}
+	if(other->lengths == NULL) {
+		return 0;
+	}
+	if(counts->lengths == NULL || other->capacity > counts->capacity) {
+		if(counts_grow(counts, other->capacity)) {
+			return -1;
+		}
+	}
+	counts_flush(other);
+
+	for(int b = 0; b < PROFILE_TALLIED; b++) {
+		for(size_t p = 0; p < other->capacity; p++) {
+			counts->counts[b][p] += other->counts[b][p];
+		}
+	}
+	for(size_t l = 0; l <= other->capacity; l++) {
+		counts->lengths[l] += other->lengths[l];
+	}
+	for(int b = 0; b < PROFILE_TALLIED; b++) {
+		counts->overflow[b] += other->overflow[b];
+	}
+	for(int k = 0; k < RNAF_LENGTH_BINS; k++) {
+		counts->length_bins[k] += other->length_bins[k];
+	}
+	for(int g = 0; g < PROFILE_GC_BINS; g++) {
+		counts->gc[g] += other->gc[g];
+	}
+
+	counts->overflow_bases += other->overflow_bases;
+	if(counts->num_reads == 0 || (other->num_reads && other->min_length < counts->min_length)) {
+		counts->min_length = other->min_length;
+	}
+	if(other->max_length > counts->max_length) {
+		counts->max_length = other->max_length;
+	}
+	counts->num_reads += other->num_reads;
+	counts->num_bases += other->num_bases;
+
+	return 0;
+}
+
+
+/* Fills the profile from the counts of every thread, returns -1 if memory could not be
+   allocated */
+static int
+counts_merge(RNA_PROFILE *profile, profile_counts *counts)
+{
+	size_t positions;
+	size_t coverage;
+	size_t sum;
+
+	if(counts->lengths == NULL && counts_grow(counts, 0)) {
+		return -1;
+	}
+	counts_flush(counts);
+
+	/* Reads longer than the capacity were binned, and so were their positions past it */
+	positions = counts->max_length < counts->capacity ? counts->max_length : counts->capacity;
+	profile->num_positions = positions;
+	profile->num_reads = counts->num_reads;
+	profile->num_bases = counts->num_bases;
+	profile->min_length = counts->min_length;
+	profile->max_length = counts->max_length;
+	memcpy(profile->length_bins, counts->length_bins, sizeof counts->length_bins);
+	memcpy(profile->gc_counts, counts->gc, sizeof counts->gc);
+
+	if((profile->length_counts = s_malloc((positions+1) * sizeof(size_t))) == NULL) {
+		return -1;
+	}
+	memcpy(profile->length_counts, counts->lengths, (positions+1) * sizeof(size_t));
+	for(int b = 0; b < RNAF_NUM_BASES; b++) {
+		profile->position_counts[b] = s_calloc(positions ? positions : 1, sizeof(size_t));
+		if(profile->position_counts[b] == NULL) {
+			return -1;
+		}
+		if(b < PROFILE_TALLIED) {
+			memcpy(profile->position_counts[b], counts->counts[b], positions * sizeof(size_t));
+			profile->overflow_counts[b] = counts->overflow[b];
+		}
+	}
+
+	/* Positions covered by a read but tallied as no base hold some other character */
+	coverage = profile->num_reads;
+	for(size_t p = 0; p < positions; p++) {
+		coverage -= profile->length_counts[p];
+		sum = 0;
+		for(int b = 0; b < PROFILE_TALLIED; b++) {
+			sum += profile->position_counts[b][p];
+		}
+		profile->position_counts[RNAF_BASE_OTHER][p] = coverage - sum;
+	}
+	sum = 0;
+	for(int b = 0; b < PROFILE_TALLIED; b++) {
+		sum += profile->overflow_counts[b];
+	}
+	profile->overflow_counts[RNAF_BASE_OTHER] = counts->overflow_bases - sum;
+
+	for(int b = 0; b < RNAF_NUM_BASES; b++) {
+		profile->base_counts[b] = profile->overflow_counts[b];
+		for(size_t p = 0; p < positions; p++) {
+			profile->base_counts[b] += profile->position_counts[b][p];
+		}
+	}
+
+	if(profile->num_bases) {
+		profile->gc_content = (double)(profile->base_counts[RNAF_BASE_C] +
+		                      profile->base_counts[RNAF_BASE_G]) / profile->num_bases;
+		profile->n_rate = (double)profile->base_counts[RNAF_BASE_N] / profile->num_bases;
+	}
+
+	return 0;
+}
+
+
+static void
+counts_free(profile_counts *counts)
+{
+	for(int b = 0; b < PROFILE_TALLIED; b++) {
+		s_free(counts->tally[b]);
+		s_free(counts->counts[b]);
+	}
+	s_free(counts->lengths);
+}
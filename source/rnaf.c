@@ -3,10 +3,14 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <zlib.h>
 
 #include "rnaf.h"
+#include "parser.h"
+#include "cache.h"
 #include "string_utils.h"
+#include "trim.h"
 #include "memory_utils.h"
 
 #define NO_OF_CHARS 256
@@ -18,27 +22,28 @@ typedef struct getm_line_info {
 	char *end_line;
 } getm_line_info;
 
-/* Function declarations */
-static void
-parse_fasta(RNA_FILE *rna_file, char **ret_seq);
-
-static void
-parse_fastq(RNA_FILE *rna_file, char **ret_seq);
-
-static void
-parse_reads(RNA_FILE *rna_file, char **ret_seq);
+/* Struct to contain the window state of rnaf_get_chunks */
+typedef struct chunk_window {
+	char          *chunk;
+	size_t        size;
+	size_t        overlap;
+	size_t        fill;
+	size_t        offset;
+	size_t        emitted;
+	int           stopped;
+	rnaf_chunk_fn cb;
+	void          *data;
+} chunk_window;
 
+/* Function declarations */
 static getm_line_info
 getm_line(char *search, unsigned int found_at);
 
-static char
-determine_filetype(char peek);
+static int
+chunk_feed(void *data, const char *seq, size_t length);
 
-static bool
-is_nucleotide(char character);
-
-static bool
-is_full(char *buffer, int buffer_size);
+static void
+chunk_emit(chunk_window *window);
 
 static void
 badCharHeuristic(const char* str, int size, int badchar[NO_OF_CHARS]);
@@ -51,40 +56,63 @@ badCharHeuristic(const char* str, int size, int badchar[NO_OF_CHARS]);
 RNA_FILE *
 rnaf_open(char* filename) 
 {
-	RNA_FILE *rna_file = s_malloc(sizeof *rna_file);
+	return rnaf_open_with(filename, NULL);
+}
+
+
+RNA_FILE *
+rnaf_open_with(char *filename, const RNA_ALLOCATOR *allocator)
+{
+	RNA_FILE    *rna_file;
+	struct stat st;
+
+	/* Handles keep a copy of the allocator they were opened with, the default may change */
+	if(allocator == NULL) {
+		allocator = s_allocator();
+	} else if(a_check(allocator)) {
+		return NULL;
+	}
+	if((rna_file = a_malloc(allocator, sizeof *rna_file)) == NULL) {
+		return NULL;
+	}
+
+	rna_file->allocator = *allocator;
 	rna_file->file = gzopen(filename, "r");
 	rna_file->filename = filename;
-	rna_file->buffer = s_malloc(MAX_SEQ_LENGTH * sizeof(char));
+	rna_file->buffer = a_calloc(allocator, MAX_SEQ_LENGTH, sizeof(char)); // init buffer to '\0'
 	rna_file->buffer_size = MAX_SEQ_LENGTH;
 	rna_file->getm_ptr = NULL;
 	rna_file->num_chars = 0;
 	rna_file->num_lines = 0;
-	memset(rna_file->buffer, 0, MAX_SEQ_LENGTH * sizeof(char)); // init buffer to '\0'
+	rna_file->stream = a_malloc(allocator, STREAM_SIZE * sizeof(char));
+	rna_file->stream_size = STREAM_SIZE;
+	rna_file->record = a_malloc(allocator, MAX_SEQ_LENGTH * sizeof(char));
+	rna_file->record_size = MAX_SEQ_LENGTH;
+	rna_file->adapter = NULL;
+	rna_file->adapter_length = 0;
+	rna_file->cache = NULL;
+	rna_file->file_size = stat(filename, &st) == 0 ? (size_t)st.st_size : 0;
 
 	/* Check if we can open file for reading */
 	if( (rna_file->file) == NULL ) {
-		free(rna_file->buffer);
-		free(rna_file);
 		error_message("Failed to open file '%s': %s",filename, strerror(errno));
+		rnaf_close(rna_file);
 		return NULL;
 	}
 
-	/* Check if file contains a valid line */
-	if(!gzgets(rna_file->file, rna_file->buffer, rna_file->buffer_size)) {
-		gzclose(rna_file->file);
-		free(rna_file->buffer);
-		free(rna_file);
-		warning_message("File '%s' contains no sequences.",filename);
+	if(rna_file->buffer == NULL || rna_file->stream == NULL || rna_file->record == NULL) {
+		rnaf_close(rna_file);
 		return NULL;
 	}
 
-	/* Determine what type of file was passed */
-	rna_file->filetype = determine_filetype(rna_file->buffer[0]);
-
-	/* Reset the file to read from beginning */
-	if(rna_file->filetype == 'r') {
-		// rewind(rna_file->file);
-		gzrewind(rna_file->file);
+	/* Determine what type of file was passed, and check if it contains anything */
+	switch(parser_select(rna_file)) {
+		case 0:
+			warning_message("File '%s' contains no sequences.",filename);
+			/* fall through */
+		case -1:
+			rnaf_close(rna_file);
+			return NULL;
 	}
 
 	return rna_file;
@@ -94,23 +122,78 @@ rnaf_open(char* filename)
 char *
 rnaf_get(RNA_FILE *rna_file) 
 {
-	char *seq = NULL;
-
-	/* Check the type of file format */
-	switch(rna_file->filetype) {
-		case 'a': parse_fasta(rna_file, &seq);    break;
-		case 'q': parse_fastq(rna_file, &seq);    break;
-		case 'r': parse_reads(rna_file, &seq);    break;
-		default:
-			error_message("Unable to read sequence from file.\nCurrent supported file types are:"
-			" FASTA, FASTQ, and files containing sequences per line.");
-			break;
+	RNA_RECORD record;
+	char       *seq;
+
+	if(rnaf_next(rna_file, &record) != 1) {
+		return NULL;
 	}
 
+	if((seq = a_malloc(&rna_file->allocator, (record.seq_length+1) * sizeof(char))) != NULL) {
+		memcpy(seq, record.seq, (record.seq_length+1) * sizeof(char));
+	}
 	return seq;
 }
 
 
+int
+rnaf_next(RNA_FILE *rna_file, RNA_RECORD *record)
+{
+	size_t length;
+	int    ret = rna_file->parse(rna_file, record);
+
+	if(rna_file->stream_error) {
+		return -1;
+	}
+
+	/* Cut the record at the adapter, records are modifiable so no copy is needed */
+	if(ret == 1 && rna_file->adapter) {
+		length = adapter_position(record->seq, record->seq_length, rna_file->adapter,
+		                          rna_file->adapter_length, rna_file->adapter_error_rate,
+		                          rna_file->adapter_overlap);
+		record->seq[length] = '\0';
+		record->seq_length = length;
+		if(record->qual && record->qual_length > length) {
+			record->qual[length] = '\0';
+			record->qual_length = length;
+		}
+	}
+
+	return ret;
+}
+
+
+int
+rnaf_set_adapter(RNA_FILE *rna_file, const char *adapter, double error_rate, size_t min_overlap)
+{
+	size_t length;
+
+	/* Written so that NaN is rejected as well */
+	if(adapter && adapter[0] != '\0' && !(error_rate >= 0 && error_rate < 1)) {
+		error_message("Adapter error rate %g is not in [0, 1).", error_rate);
+		return -1;
+	}
+
+	a_free(&rna_file->allocator, rna_file->adapter);
+	rna_file->adapter = NULL;
+	rna_file->adapter_length = 0;
+
+	if(adapter == NULL || adapter[0] == '\0') {
+		return 0;
+	}
+
+	length = strlen(adapter);
+	if((rna_file->adapter = a_malloc(&rna_file->allocator, (length+1) * sizeof(char))) == NULL) {
+		return -1;
+	}
+	memcpy(rna_file->adapter, adapter, (length+1) * sizeof(char));
+	rna_file->adapter_length = length;
+	rna_file->adapter_error_rate = error_rate;
+	rna_file->adapter_overlap = min_overlap;
+	return 0;
+}
+
+
 char *
 rnaf_getm(RNA_FILE *rna_file, char *match)
 {
@@ -161,6 +244,50 @@ rnaf_getm(RNA_FILE *rna_file, char *match)
 }
 
 
+int
+rnaf_get_chunks(RNA_FILE *rna_file, rnaf_chunk_fn cb, size_t chunk_size, size_t overlap,
+                void *data)
+{
+	chunk_window window;
+	int          ret;
+
+	if(cb == NULL || chunk_size == 0 || overlap >= chunk_size) {
+		error_message("Unable to stream sequence: overlap (%zu) must be smaller than chunk size "
+		"(%zu).", overlap, chunk_size);
+		return -1;
+	}
+
+	window = (chunk_window) {
+		.chunk = a_malloc(&rna_file->allocator, (chunk_size+1) * sizeof(char)),
+		.size = chunk_size,
+		.overlap = overlap,
+		.fill = 0,
+		.offset = 0,
+		.emitted = 0,
+		.stopped = 0,
+		.cb = cb,
+		.data = data
+	};
+
+	if(window.chunk == NULL) {
+		return -1;
+	}
+
+	ret = parser_stream(rna_file, chunk_feed, &window);
+	if(rna_file->stream_error) {
+		ret = -1;
+	}
+
+	/* Deliver what is left of the sequence, unless it is all overlap of the previous window */
+	if(ret == 1 && window.fill > (window.emitted ? window.overlap : 0)) {
+		chunk_emit(&window);
+	}
+
+	a_free(&rna_file->allocator, window.chunk);
+	return ret;
+}
+
+
 size_t 
 rnaf_oread(RNA_FILE *rna_file, unsigned int offset)
 {
@@ -191,20 +318,36 @@ rnaf_oread(RNA_FILE *rna_file, unsigned int offset)
 void 
 rnaf_close(RNA_FILE *rna_file) 
 {
+	RNA_ALLOCATOR allocator = rna_file->allocator;
+
 	// fclose(rna_file->file);
 	gzclose(rna_file->file);
-	free(rna_file->buffer);
-	free(rna_file);
+	if(rna_file->cache) {
+		cache_close(rna_file);
+	}
+
+	a_free(&allocator, rna_file->adapter);
+	a_free(&allocator, rna_file->record);
+	a_free(&allocator, rna_file->stream);
+	a_free(&allocator, rna_file->buffer);
+	a_free(&allocator, rna_file);
 }
 
 
-void
+int
 rnaf_rebuff(RNA_FILE *rna_file, size_t mem_size)
 {
-	rna_file->buffer = s_realloc(rna_file->buffer, mem_size+1);
+	char *buffer;
+
+	if((buffer = a_realloc(&rna_file->allocator, rna_file->buffer, mem_size+1)) == NULL) {
+		return -1;
+	}
+	rna_file->buffer = buffer;
 	rna_file->buffer_size = mem_size;
 	gzrewind(rna_file->file);
+	parser_reset(rna_file);
 	memset(rna_file->buffer, 0, (mem_size+1) * sizeof(char));
+	return 0;
 }
 
 
@@ -311,94 +454,6 @@ rnaf_numlines(RNA_FILE *rna_file)
 #  Helper Functions                                        #
 ##########################################################*/
 
-static void
-parse_fasta(RNA_FILE *rna_file, char **ret_seq) 
-{   /* Init seq, will be realloc'd based on input stream */
-	char    *seq = NULL;
-
-	// while (fgets(rna_file->buffer, rna_file->buffer_size, rna_file->file)) { 
-	while(gzgets(rna_file->file, rna_file->buffer, rna_file->buffer_size)) {
-		if (rna_file->buffer[0] == '>') {
-			/* If buffer wasn't large enough to store header, keep reading */
-			while(is_full(rna_file->buffer, rna_file->buffer_size)) {
-				// fgets(rna_file->buffer, rna_file->buffer_size, rna_file->file);
-				gzgets(rna_file->file, rna_file->buffer, rna_file->buffer_size);
-			}
-			break;  /* New sequence, so break */
-		}
-
-		/* Append sequence found in buffer into seq variable */
-		append(&seq, rna_file->buffer);
-	}
-
-	/* Have ret_seq point to new seq */
-	*ret_seq = seq;
-}
-
-
-static void
-parse_fastq(RNA_FILE *rna_file, char **ret_seq) 
-{
-	char            *seq = NULL; /* Init seq, will be realloc'd based on input stream */
-	unsigned int    reading_seq = 1;
-	unsigned int	current_iter = 0;
-
-	// while(fgets(rna_file->buffer, rna_file->buffer_size, rna_file->file)) {
-	while(gzgets(rna_file->file, rna_file->buffer, rna_file->buffer_size)) {
-		current_iter+=1;
-
-		if(rna_file->buffer[0] == '@' && current_iter == 4) {
-			/* If buffer wasn't large enough to store header, keep reading */
-			while(is_full(rna_file->buffer, rna_file->buffer_size)) {
-				// fgets(rna_file->buffer, rna_file->buffer_size, rna_file->file);
-				gzgets(rna_file->file, rna_file->buffer, rna_file->buffer_size);
-			}
-			break;  /* New sequence, so break */
-		}
-
-		if(rna_file->buffer[0] == '+') {
-			reading_seq = 0;
-			continue;   /* Reading from metadata, so skip iteration */
-		}
-
-		/* Append sequence found in buffer into seq variable */
-		if(reading_seq) {
-			append(&seq, rna_file->buffer);
-		}
-	}
-
-	/* Have ret_seq point to new seq */
-	*ret_seq = seq;
-}
-
-
-static void
-parse_reads(RNA_FILE *rna_file, char **ret_seq) 
-{
-	char *seq = NULL;
-
-	/* Get next line, and if NULL, return */
-	// if(!fgets(rna_file->buffer, rna_file->buffer_size, rna_file->file)) {
-	if(!gzgets(rna_file->file, rna_file->buffer, rna_file->buffer_size)) {
-		return;
-	}
-
-	/* Append the read file to seq */
-	append(&seq, rna_file->buffer);
-
-	/* If buffer was not large enough to store sequence, keep reading */
-	while(is_full(rna_file->buffer, rna_file->buffer_size)) {
-		memset(rna_file->buffer, 0, rna_file->buffer_size*sizeof(char));
-		// fgets(rna_file->buffer, rna_file->buffer_size, rna_file->file);
-		gzgets(rna_file->file, rna_file->buffer, rna_file->buffer_size);
-		append(&seq, rna_file->buffer);
-	}
-
-	/* Have ret_seq point to new seq */
-	*ret_seq = seq;
-}
-
-
 static getm_line_info
 getm_line(char *search, unsigned int found_at) 
 {
@@ -429,48 +484,47 @@ getm_line(char *search, unsigned int found_at)
 }
 
 
-static char
-determine_filetype(char peek) 
+static int
+chunk_feed(void *data, const char *seq, size_t length)
 {
-	char ret;
+	chunk_window *window = data;
 
-	if( is_nucleotide(peek) ) {
-		ret = 'r';  /* reads file */
-	} else if(peek == '@') {
-		ret = 'q';  /* fastq file */
-	} else if(peek == '>') {
-		ret = 'a';  /* fasta file */
-	} else {
-		ret = '\0'; /* unsupported file type */
-	}
+	while(length) {
+		size_t count = window->size - window->fill;
+		if(count > length) {
+			count = length;
+		}
 
-	return ret;
-}
+		memcpy(window->chunk + window->fill, seq, count * sizeof(char));
+		window->fill += count;
+		seq += count;
+		length -= count;
 
+		if(window->fill == window->size) {
+			chunk_emit(window);
 
-static bool
-is_nucleotide(char character)
-{
-	switch(character) {
-		case 'A':   return true;
-		case 'a':   return true;
-		case 'C':   return true;
-		case 'c':   return true;
-		case 'G':   return true;
-		case 'g':   return true;
-		case 'T':   return true;
-		case 't':   return true;
-		case 'U':   return true;
-		case 'u':   return true;
-		default:    return false;
+			/* Keep the last overlap characters as the beginning of the next window */
+			memmove(window->chunk, window->chunk + window->size - window->overlap,
+			        window->overlap * sizeof(char));
+			window->offset += window->size - window->overlap;
+			window->fill = window->overlap;
+		}
 	}
+
+	/* The whole record is read even once the callback stopped, so the next one starts cleanly */
+	return 0;
 }
 
 
-static bool
-is_full(char *buffer, int buffer_size)
+static void
+chunk_emit(chunk_window *window)
 {
-	return buffer[buffer_size-1] == '\0' && is_nucleotide(buffer[buffer_size-2]);
+	/* Once the callback asks to stop, the rest of the sequence is only consumed */
+	if(!window->stopped) {
+		window->chunk[window->fill] = '\0';
+		window->stopped = window->cb(window->chunk, window->fill, window->offset, window->data);
+	}
+	window->emitted++;
 }
 
 
@@ -6,22 +6,12 @@
 #include "memory_utils.h"
 #include "string_utils.h"
 
-void append(char **s1, const char *s2) {
-    const size_t len1 = *s1 ? strlen(*s1) : 0;
-    const size_t len2 =  s2 ? strlen(s2)  : 0;
-
-    if(len2 == 0) {
-        return;     // s2 is NULL or empty, so dont modify contents of s1
-    }
-
-    *s1 = s_realloc(*s1,len1 + len2 + 1);
-
-    if(len1 == 0) {
-        strcpy(*s1, s2);    // s1 is NULL or empty, so copy contents of s2
-    } else {
-        strcat(*s1, s2);    // append contents of s2 onto s1
-    }
-}
+const unsigned char char_class[256] = {
+    ['A'] = CHAR_NUCLEOTIDE, ['C'] = CHAR_NUCLEOTIDE, ['G'] = CHAR_NUCLEOTIDE,
+    ['T'] = CHAR_NUCLEOTIDE, ['U'] = CHAR_NUCLEOTIDE,
+    ['a'] = CHAR_NUCLEOTIDE, ['c'] = CHAR_NUCLEOTIDE, ['g'] = CHAR_NUCLEOTIDE,
+    ['t'] = CHAR_NUCLEOTIDE, ['u'] = CHAR_NUCLEOTIDE,
+};
 
 
 void clean_seq(char *sequence, int do_substitute) {
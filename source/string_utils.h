@@ -1,18 +1,17 @@
 #ifndef STRING_UTILS_H
 #define STRING_UTILS_H
 
+#define CHAR_NUCLEOTIDE 0x01    /* A, C, G, T and U in either case */
 
 /**
- *  @brief Appends the contents of the second string to the end of the first string.
- * 
- *  The function allocates memory for the combined result and updates the first string accordingly.
- *  If the first string is null or empty, it essentially duplicates the contents of `s2` into `s1`.
- *  Similarly, if `s2` is null or empty, then the contents of `s1` will remain the same.
- *
- *  @param s1 The pointer to the first string (modifiable).
- *  @param s2 The second string to append.
+ *  @brief Check whether a character belongs to any of the given CHAR_* classes.
+ */
+#define IS_CHAR_CLASS(C, CLASS) (char_class[(unsigned char)(C)] & (CLASS))
+
+/**
+ *  @brief Lookup table with the CHAR_* classes of every character.
  */
-void append(char **s1, const char *s2);
+extern const unsigned char char_class[256];
 
 
 /**
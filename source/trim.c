@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "trim.h"
+#include "memory_utils.h"
+
+/* Function declarations */
+static size_t
+count_mismatches(const char *s1, const char *s2, size_t length, size_t limit);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+size_t
+adapter_position(const char *seq, size_t seq_length, const char *adapter,
+                 size_t adapter_length, double error_rate, size_t min_overlap)
+{
+	size_t overlap;
+	size_t allowed;
+
+	if(min_overlap == 0) {
+		min_overlap = 1;
+	}
+
+	for(size_t i = 0; i + min_overlap <= seq_length; i++) {
+		overlap = seq_length - i < adapter_length ? seq_length - i : adapter_length;
+		allowed = (size_t)(error_rate * overlap);
+
+		if(count_mismatches(seq + i, adapter, overlap, allowed) <= allowed) {
+			return i;
+		}
+	}
+
+	return seq_length;
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+/* Counts the mismatches of two strings, stops counting once there are more than limit */
+static size_t
+count_mismatches(const char *s1, const char *s2, size_t length, size_t limit)
+{
+	size_t mismatches = 0;
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	/* Compare 16 characters at once */
+	for(; i + 16 <= length && mismatches <= limit; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(s1 + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(s2 + i));
+		unsigned int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+		mismatches += __builtin_popcount(~equal & 0xffff);
+	}
+#endif
+
+	for(; i < length && mismatches <= limit; i++) {
+		mismatches += s1[i] != s2[i];
+	}
+
+	return mismatches;
+}
@@ -0,0 +1,26 @@
+#ifndef TRIM_H
+#define TRIM_H
+
+#include <stddef.h>
+
+/**
+ *  @brief Find the first occurrence of an adapter in a sequence.
+ *
+ *  An occurrence starting at position i is compared over min(adapter_length, seq_length - i)
+ *  characters, so a prefix of the adapter at the 3' end of the sequence also counts, as long as
+ *  it is at least min_overlap characters long. An occurrence may contain up to
+ *  error_rate * (compared characters) mismatches.
+ *
+ *  @param seq              The sequence to search
+ *  @param seq_length       The number of characters in seq
+ *  @param adapter          The adapter to search for
+ *  @param adapter_length   The number of characters in adapter
+ *  @param error_rate       The maximum fraction of mismatches in an occurrence
+ *  @param min_overlap      The minimum number of characters of a partial occurrence
+ *
+ *  @return The position of the first occurrence, or seq_length if there is none
+*/
+size_t adapter_position(const char *seq, size_t seq_length, const char *adapter,
+                        size_t adapter_length, double error_rate, size_t min_overlap);
+
+#endif // TRIM_H
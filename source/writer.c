@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "rnaf.h"
+#include "memory_utils.h"
+
+#define BGZF_BLOCK_SIZE  65280      /* Input of a BGZF block, so the output fits in 64 KiB */
+#define GZIP_BLOCK_SIZE  1048576    /* Input of a gzip member */
+#define PLAIN_BLOCK_SIZE 1048576    /* Size of the blocks written without compression */
+#define BGZF_HEADER_SIZE 18
+#define BGZF_FOOTER_SIZE 8
+
+/* The empty block that marks the end of a BGZF file */
+static const unsigned char bgzf_eof[28] = {
+	0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+	0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+/* States of a block while it is compressed */
+enum block_state {BLOCK_FREE, BLOCK_PENDING, BLOCK_RUNNING, BLOCK_DONE};
+
+/* Struct to contain a block of output and its compressed form */
+typedef struct writer_block {
+	unsigned char    *in;
+	size_t           in_len;
+	unsigned char    *out;
+	size_t           out_len;
+	size_t           out_size;
+	int              status;
+	enum block_state state;
+} writer_block;
+
+struct RNA_WRITER {
+	FILE            *file;
+	char            *filename;
+	char            filetype;
+	int             compression;
+	size_t          block_size;     /* Number of characters formatted into a block */
+	writer_block    *blocks;        /* Ring of blocks, written in order */
+	size_t          num_blocks;
+	size_t          head;           /* Oldest block that is not written yet */
+	size_t          tail;           /* Block currently being filled */
+	int             status;
+	pthread_t       *threads;
+	int             nthreads;
+	bool            stop;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+};
+
+/* Function declarations */
+static int
+writer_append(RNA_WRITER *writer, const char *str, size_t length);
+
+static int
+writer_submit(RNA_WRITER *writer);
+
+static int
+writer_write(RNA_WRITER *writer, bool wait);
+
+static void *
+writer_work(void *arg);
+
+static int
+compress_block(writer_block *block, int compression);
+
+static void
+writer_free(RNA_WRITER *writer);
+
+
+/*##########################################################
+#  Main Functions (Used in header)                         #
+##########################################################*/
+
+RNA_WRITER *
+rnaf_writer_open(char *filename, char filetype, int compression, int nthreads)
+{
+	RNA_WRITER *writer;
+	size_t     out_size;
+	bool       failed;
+
+	if(filetype != 'a' && filetype != 'q' && filetype != 'r') {
+		error_message("Unable to write file '%s'.\nCurrent supported file types are:"
+		" FASTA, FASTQ, and files containing sequences per line.", filename);
+		return NULL;
+	}
+
+	if(compression != RNAF_PLAIN && compression != RNAF_GZIP && compression != RNAF_BGZF) {
+		error_message("Unable to write file '%s'.\nCurrent supported compressions are:"
+		" RNAF_PLAIN, RNAF_GZIP, and RNAF_BGZF.", filename);
+		return NULL;
+	}
+
+	if((writer = s_calloc(1, sizeof *writer)) == NULL) {
+		return NULL;
+	}
+	if((writer->file = fopen(filename, "wb")) == NULL) {
+		error_message("Failed to open file '%s': %s", filename, strerror(errno));
+		s_free(writer);
+		return NULL;
+	}
+
+	writer->filename = filename;
+	writer->filetype = filetype;
+	writer->compression = compression;
+	writer->nthreads = nthreads > 0 && compression != RNAF_PLAIN ? nthreads : 0;
+
+	switch(compression) {
+		case RNAF_BGZF:  writer->block_size = BGZF_BLOCK_SIZE;  break;
+		case RNAF_GZIP:  writer->block_size = GZIP_BLOCK_SIZE;  break;
+		case RNAF_PLAIN: writer->block_size = PLAIN_BLOCK_SIZE; break;
+	}
+
+	/* Keep every thread busy while the oldest block is written */
+	writer->num_blocks = writer->nthreads ? 2 * writer->nthreads : 1;
+	writer->blocks = s_calloc(writer->num_blocks, sizeof *writer->blocks);
+	writer->threads = s_malloc(writer->nthreads * sizeof *writer->threads);
+	failed = writer->blocks == NULL || (writer->nthreads && writer->threads == NULL);
+	out_size = compressBound(writer->block_size) + 64;
+	for(size_t i = 0; i < writer->num_blocks && !failed; i++) {
+		writer->blocks[i].in = s_malloc(writer->block_size);
+		writer->blocks[i].out = compression == RNAF_PLAIN ? NULL : s_malloc(out_size);
+		writer->blocks[i].out_size = out_size;
+		failed = !writer->blocks[i].in || (compression != RNAF_PLAIN && !writer->blocks[i].out);
+	}
+
+	if(failed) {
+		fclose(writer->file);
+		writer_free(writer);
+		return NULL;
+	}
+
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->cond, NULL);
+	for(int i = 0; i < writer->nthreads; i++) {
+		if(pthread_create(&writer->threads[i], NULL, writer_work, writer)) {
+			error_message("Failed to start a compression thread for file '%s'.", filename);
+
+			/* Stop the threads started so far before freeing the blocks they wait on */
+			pthread_mutex_lock(&writer->lock);
+			writer->stop = true;
+			pthread_cond_broadcast(&writer->cond);
+			pthread_mutex_unlock(&writer->lock);
+			for(int j = 0; j < i; j++) {
+				pthread_join(writer->threads[j], NULL);
+			}
+
+			fclose(writer->file);
+			pthread_cond_destroy(&writer->cond);
+			pthread_mutex_destroy(&writer->lock);
+			writer_free(writer);
+			return NULL;
+		}
+	}
+
+	return writer;
+}
+
+
+int
+rnaf_writer_put(RNA_WRITER *writer, const RNA_RECORD *record)
+{
+	const char *name = record->name ? record->name : "";
+
+	if(writer->filetype == 'q' && record->qual == NULL) {
+		error_message("Unable to write record '%s' to FASTQ file '%s': it has no quality.",
+		              name, writer->filename);
+		return -1;
+	}
+
+	switch(writer->filetype) {
+		case 'a':
+			writer_append(writer, ">", 1);
+			writer_append(writer, name, record->name_length);
+			writer_append(writer, "\n", 1);
+			break;
+		case 'q':
+			writer_append(writer, "@", 1);
+			writer_append(writer, name, record->name_length);
+			writer_append(writer, "\n", 1);
+			break;
+	}
+
+	writer_append(writer, record->seq, record->seq_length);
+	writer_append(writer, "\n", 1);
+
+	if(writer->filetype == 'q') {
+		writer_append(writer, "+\n", 2);
+		writer_append(writer, record->qual, record->qual_length);
+		writer_append(writer, "\n", 1);
+	}
+
+	return writer->status;
+}
+
+
+int
+rnaf_writer_put_batch(RNA_WRITER *writer, const RNA_BATCH *batch)
+{
+	for(size_t i = 0; i < batch->count; i++) {
+		if(rnaf_writer_put(writer, &batch->records[i])) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+int
+rnaf_writer_close(RNA_WRITER *writer)
+{
+	int status;
+
+	/* Compress and write the last, partially filled block */
+	if(writer->blocks[writer->tail % writer->num_blocks].in_len) {
+		writer_submit(writer);
+	}
+	while(writer->head < writer->tail) {
+		writer_write(writer, true);
+	}
+
+	if(writer->compression == RNAF_BGZF && !writer->status &&
+	   fwrite(bgzf_eof, 1, sizeof bgzf_eof, writer->file) != sizeof bgzf_eof) {
+		writer->status = -1;
+	}
+
+	pthread_mutex_lock(&writer->lock);
+	writer->stop = true;
+	pthread_cond_broadcast(&writer->cond);
+	pthread_mutex_unlock(&writer->lock);
+	for(int i = 0; i < writer->nthreads; i++) {
+		pthread_join(writer->threads[i], NULL);
+	}
+
+	if(fclose(writer->file) && !writer->status) {
+		writer->status = -1;
+	}
+	if(writer->status) {
+		error_message("Failed to write file '%s'.", writer->filename);
+	}
+	status = writer->status;
+
+	pthread_cond_destroy(&writer->cond);
+	pthread_mutex_destroy(&writer->lock);
+	writer_free(writer);
+
+	return status;
+}
+
+
+/*##########################################################
+#  Helper Functions                                        #
+##########################################################*/
+
+static int
+writer_append(RNA_WRITER *writer, const char *str, size_t length)
+{
+	writer_block *block;
+	size_t       count;
+
+	while(length) {
+		block = &writer->blocks[writer->tail % writer->num_blocks];
+		count = writer->block_size - block->in_len;
+		if(count > length) {
+			count = length;
+		}
+
+		memcpy(block->in + block->in_len, str, count);
+		block->in_len += count;
+		str += count;
+		length -= count;
+
+		/* Records may span blocks, so hand over the block as soon as it is full */
+		if(block->in_len == writer->block_size) {
+			writer_submit(writer);
+		}
+	}
+
+	return writer->status;
+}
+
+
+/* Hands the block being filled over for compression, and moves on to the next block */
+static int
+writer_submit(RNA_WRITER *writer)
+{
+	writer_block *block = &writer->blocks[writer->tail % writer->num_blocks];
+
+	if(writer->nthreads == 0) {
+		block->status = compress_block(block, writer->compression);
+		block->state = BLOCK_DONE;
+	} else {
+		pthread_mutex_lock(&writer->lock);
+		block->state = BLOCK_PENDING;
+		pthread_cond_broadcast(&writer->cond);
+		pthread_mutex_unlock(&writer->lock);
+	}
+	writer->tail++;
+
+	/* Write finished blocks, waiting for the oldest one if the ring is full */
+	while(writer->head < writer->tail && writer_write(writer, writer->tail - writer->head ==
+	      writer->num_blocks));
+
+	writer->blocks[writer->tail % writer->num_blocks].in_len = 0;
+	return writer->status;
+}
+
+
+/* Writes the oldest block if it is compressed, returns whether it was written */
+static int
+writer_write(RNA_WRITER *writer, bool wait)
+{
+	writer_block *block = &writer->blocks[writer->head % writer->num_blocks];
+	const void   *data;
+	size_t       length;
+
+	pthread_mutex_lock(&writer->lock);
+	while(wait && block->state != BLOCK_DONE) {
+		pthread_cond_wait(&writer->cond, &writer->lock);
+	}
+	if(block->state != BLOCK_DONE) {
+		pthread_mutex_unlock(&writer->lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	data = writer->compression == RNAF_PLAIN ? (void *)block->in : (void *)block->out;
+	length = writer->compression == RNAF_PLAIN ? block->in_len : block->out_len;
+	if(block->status || (!writer->status && fwrite(data, 1, length, writer->file) != length)) {
+		writer->status = -1;
+	}
+
+	pthread_mutex_lock(&writer->lock);
+	block->state = BLOCK_FREE;
+	pthread_mutex_unlock(&writer->lock);
+	writer->head++;
+	return 1;
+}
+
+
+static void *
+writer_work(void *arg)
+{
+	RNA_WRITER   *writer = arg;
+	writer_block *block;
+	int          status;
+
+	pthread_mutex_lock(&writer->lock);
+	while(1) {
+		/* Take any pending block, they are written in order regardless */
+		block = NULL;
+		for(size_t i = 0; i < writer->num_blocks && !block; i++) {
+			if(writer->blocks[i].state == BLOCK_PENDING) {
+				block = &writer->blocks[i];
+			}
+		}
+
+		if(block == NULL) {
+			if(writer->stop) {
+				break;
+			}
+			pthread_cond_wait(&writer->cond, &writer->lock);
+			continue;
+		}
+
+		block->state = BLOCK_RUNNING;
+		pthread_mutex_unlock(&writer->lock);
+
+		status = compress_block(block, writer->compression);
+
+		pthread_mutex_lock(&writer->lock);
+		block->status = status;
+		block->state = BLOCK_DONE;
+		pthread_cond_broadcast(&writer->cond);
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	return NULL;
+}
+
+
+static int
+compress_block(writer_block *block, int compression)
+{
+	z_stream      stream = {0};
+	unsigned char *out = block->out;
+	unsigned long crc;
+	size_t        header = compression == RNAF_BGZF ? BGZF_HEADER_SIZE : 0;
+	size_t        size;
+
+	if(compression == RNAF_PLAIN) {
+		return 0;
+	}
+
+	/* BGZF blocks are raw deflate data in a gzip member with the block size in its header */
+	if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+	                compression == RNAF_BGZF ? -15 : 31, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return -1;
+	}
+
+	stream.next_in = block->in;
+	stream.avail_in = block->in_len;
+	stream.next_out = out + header;
+	stream.avail_out = block->out_size - header - BGZF_FOOTER_SIZE;
+	if(deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&stream);
+		return -1;
+	}
+	block->out_len = header + stream.total_out;
+	deflateEnd(&stream);
+
+	if(compression == RNAF_BGZF) {
+		size = block->out_len + BGZF_FOOTER_SIZE;
+		crc = crc32(0L, block->in, block->in_len);
+
+		memcpy(out, bgzf_eof, BGZF_HEADER_SIZE);
+		out[16] = (size-1) & 0xff;
+		out[17] = (size-1) >> 8;
+
+		out += block->out_len;
+		for(int i = 0; i < 4; i++) {
+			out[i] = (crc >> (8*i)) & 0xff;
+			out[4+i] = (block->in_len >> (8*i)) & 0xff;
+		}
+		block->out_len = size;
+	}
+
+	return 0;
+}
+
+
+/* Frees the blocks and threads of a writer, along with the writer */
+static void
+writer_free(RNA_WRITER *writer)
+{
+	for(size_t i = 0; writer->blocks && i < writer->num_blocks; i++) {
+		s_free(writer->blocks[i].in);
+		s_free(writer->blocks[i].out);
+	}
+	s_free(writer->threads);
+	s_free(writer->blocks);
+	s_free(writer);
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+/* Struct to contain the state of a counting allocator */
+typedef struct counter {
+	size_t calls;           /* Number of malloc_fn and realloc_fn calls */
+	size_t live;            /* Number of blocks not yet freed */
+	size_t fail_at;         /* Call that fails and every one after it, 0 to never fail */
+} counter;
+
+
+static void *
+count_malloc(void *data, size_t size)
+{
+	counter *c = data;
+	void    *ptr;
+
+	if(c->fail_at && ++c->calls >= c->fail_at) {
+		return NULL;
+	}
+	if((ptr = malloc(size)) != NULL) {
+		c->live++;
+	}
+	return ptr;
+}
+
+
+static void *
+count_realloc(void *data, void *ptr, size_t size)
+{
+	counter *c = data;
+	void    *resized;
+
+	if(c->fail_at && ++c->calls >= c->fail_at) {
+		return NULL;
+	}
+	if((resized = realloc(ptr, size)) != NULL && ptr == NULL) {
+		c->live++;
+	}
+	return resized;
+}
+
+
+static void
+count_free(void *data, void *ptr)
+{
+	counter *c = data;
+
+	c->live--;
+	free(ptr);
+}
+
+
+/* Reads every record of a file with the allocator, returns the result of the last read */
+static int
+read_with(const char *filename, const RNA_ALLOCATOR *allocator)
+{
+	RNA_FILE   *rna_file;
+	RNA_RECORD record;
+	int        ret;
+
+	if((rna_file = rnaf_open_with((char *)filename, allocator)) == NULL) {
+		return -1;
+	}
+	while((ret = rnaf_next(rna_file, &record)) == 1);
+	rnaf_close(rna_file);
+
+	return ret;
+}
+
+
+int
+main(void)
+{
+	counter       c = {0};
+	RNA_ALLOCATOR allocator = {count_malloc, count_realloc, count_free, &c};
+	RNA_ALLOCATOR partial = {count_malloc, NULL, count_free, &c};
+	RNA_BATCH     *batch;
+	int           succeeded = 0;
+
+	write_file("reads.fq", "@a\nACGT\n+\nIIII\n@b\nGGCC\n+\nIIII\n");
+
+	/* Every block of a handle comes from its allocator and goes back to it */
+	CHECK(read_with("reads.fq", &allocator) == 0);
+	CHECK(c.live == 0);
+
+	/* Failures are reported instead of exiting, and leave nothing allocated */
+	for(c.fail_at = 1; c.fail_at < 64 && !succeeded; c.fail_at++) {
+		c.calls = 0;
+		succeeded = read_with("reads.fq", &allocator) == 0;
+		CHECK(c.live == 0);
+	}
+	CHECK(succeeded);
+	c.fail_at = 0;
+
+	/* Allocators set all of their functions or none */
+	CHECK(rnaf_open_with("reads.fq", &partial) == NULL);
+	CHECK(rnaf_set_allocator(&partial) == -1);
+
+	/* The default allocator is used by batches */
+	CHECK(rnaf_set_allocator(&allocator) == 0);
+	if(CHECK((batch = rnaf_batch_create(4)) != NULL)) {
+		CHECK(c.live > 0);
+		rnaf_batch_free(batch);
+	}
+	CHECK(c.live == 0);
+	CHECK(rnaf_set_allocator(NULL) == 0);
+
+	return test_result();
+}
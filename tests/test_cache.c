@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+/* Offsets of the section offsets in the header of a cache */
+#define CACHE_STARTS     48
+#define CACHE_EXCEPTIONS 56
+
+
+/* Checks that the records of a cache match the records of the file it was built from, returns
+   the number of records */
+static size_t
+check_cache(const char *filename, RNA_FILE *cache, int flags)
+{
+	RNA_FILE   *rna_file = rnaf_open((char *)filename);
+	RNA_RECORD expected;
+	RNA_RECORD record;
+	size_t     count = 0;
+	size_t     different = 0;
+	int        ret;
+
+	if(!CHECK(rna_file != NULL)) {
+		return 0;
+	}
+
+	while((ret = rnaf_next(rna_file, &expected)) == 1) {
+		if(!CHECK(rnaf_next(cache, &record) == 1)) {
+			break;
+		}
+		count++;
+		different += record.seq_length != expected.seq_length ||
+		             memcmp(record.seq, expected.seq, record.seq_length) != 0 ||
+		             record.seq[record.seq_length] != '\0';
+		if(flags & RNAF_CACHE_NAMES) {
+			different += record.name_length != expected.name_length ||
+			             memcmp(record.name, expected.name, record.name_length) != 0;
+		} else {
+			different += record.name != NULL;
+		}
+		if(flags & RNAF_CACHE_QUALS) {
+			different += record.qual_length != expected.qual_length ||
+			             memcmp(record.qual, expected.qual, record.qual_length) != 0;
+		} else {
+			different += record.qual != NULL;
+		}
+	}
+	CHECK(ret == 0);
+	CHECK(rnaf_next(cache, &record) == 0);
+	CHECK(different == 0);
+
+	rnaf_close(rna_file);
+	return count;
+}
+
+
+static void
+test_build(const char *filename, const char *cache_filename, int flags, size_t num_records)
+{
+	RNA_FILE *cache;
+
+	CHECK(rnaf_cache_build((char *)filename, (char *)cache_filename, flags) == 0);
+	if(!CHECK((cache = rnaf_open((char *)cache_filename)) != NULL)) {
+		return;
+	}
+	CHECK(cache->cache != NULL);
+	CHECK(check_cache(filename, cache, flags) == num_records);
+
+	/* Resizing the buffer rewinds the cache to its first record */
+	CHECK(rnaf_rebuff(cache, 1024) == 0);
+	CHECK(check_cache(filename, cache, flags) == num_records);
+
+	rnaf_close(cache);
+}
+
+
+/* Copies a cache, swapping two entries of the uint64_t section whose offset is stored at
+   header_field in the header */
+static int
+corrupt_cache(const char *source, const char *destination, size_t header_field, size_t i,
+              size_t j)
+{
+	FILE     *file = fopen(source, "rb");
+	char     data[4096];
+	size_t   length;
+	uint64_t offset;
+	uint64_t swap;
+
+	if(file == NULL) {
+		return -1;
+	}
+	length = fread(data, 1, sizeof data, file);
+	fclose(file);
+
+	memcpy(&offset, data + header_field, sizeof offset);
+	if(offset + (j+1) * sizeof(uint64_t) > length) {
+		return -1;
+	}
+	memcpy(&swap, data + offset + i*sizeof(uint64_t), sizeof swap);
+	memmove(data + offset + i*sizeof(uint64_t), data + offset + j*sizeof(uint64_t), sizeof swap);
+	memcpy(data + offset + j*sizeof(uint64_t), &swap, sizeof swap);
+
+	if((file = fopen(destination, "wb")) == NULL) {
+		return -1;
+	}
+	fwrite(data, 1, length, file);
+	fclose(file);
+	return 0;
+}
+
+
+int
+main(void)
+{
+	RNA_FILE   *cache;
+	RNA_RECORD record;
+
+	/* Characters other than A, C, G and T are stored as exceptions */
+	write_file("small.fq", "@c1 first\nACGTNacgtRY\n+\nABCDEFGHIJK\n@c2\n\n+\n\n@c3\nTTTTGGGG\n+\n"
+	                       "@@@@IIII\n@c4\nN\n+\n#\n");
+	test_build("small.fq", "small.rnafc", RNAF_CACHE_NAMES | RNAF_CACHE_QUALS, 4);
+	test_build("small.fq", "names.rnafc", RNAF_CACHE_NAMES, 4);
+	test_build("small.fq", "bases.rnafc", 0, 4);
+
+	write_fastq("large.fq.gz", 20000, 7);
+	test_build("large.fq.gz", "large.rnafc", RNAF_CACHE_NAMES | RNAF_CACHE_QUALS, 20000);
+
+	/* Qualities are only stored for FASTQ files */
+	write_file("rna.fa", ">u1\nACGUU\nGG\n>u2\nUUUU\n");
+	test_build("rna.fa", "rna.rnafc", RNAF_CACHE_NAMES, 2);
+	CHECK(rnaf_cache_build("rna.fa", "rna.rnafc", RNAF_CACHE_NAMES | RNAF_CACHE_QUALS) == 0);
+	if(CHECK((cache = rnaf_open("rna.rnafc")) != NULL)) {
+		CHECK(rnaf_next(cache, &record) == 1);
+		CHECK_STR(record.seq, record.seq_length, "ACGUUGG");
+		CHECK(record.qual == NULL);
+		rnaf_close(cache);
+	}
+
+	/* Truncated caches are rejected */
+	write_file("broken.rnafc", "RNAFC\x01\r\n0123456789");
+	CHECK(rnaf_open("broken.rnafc") == NULL);
+
+	/* So are caches with unsorted exceptions or starts that do not end at the last base */
+	CHECK(corrupt_cache("small.rnafc", "unsorted.rnafc", CACHE_EXCEPTIONS, 0, 1) == 0);
+	CHECK(rnaf_open("unsorted.rnafc") == NULL);
+	CHECK(corrupt_cache("small.rnafc", "starts.rnafc", CACHE_STARTS, 3, 4) == 0);
+	CHECK(rnaf_open("starts.rnafc") == NULL);
+
+	return test_result();
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+#define LONG_LENGTH 2000000
+
+/* Struct to contain the windows delivered by rnaf_get_chunks() */
+typedef struct chunk_log {
+	char   text[256];
+	size_t used;
+	int    stop_after;      /* Number of windows after which to stop, 0 to read them all */
+	int    count;
+} chunk_log;
+
+
+/* Appends "offset:chunk " to the log */
+static int
+log_chunk(const char *chunk, size_t length, size_t offset, void *data)
+{
+	chunk_log *log = data;
+
+	log->used += snprintf(log->text + log->used, sizeof log->text - log->used, "%zu:%.*s ",
+	                      offset, (int)length, chunk);
+	return ++log->count == log->stop_after;
+}
+
+
+/* Struct to compare the windows delivered by rnaf_get_chunks() with the expected sequence */
+typedef struct chunk_compare {
+	const char *expected;
+	size_t     length;
+	size_t     end;             /* End of the windows delivered so far */
+	size_t     different;
+} chunk_compare;
+
+
+static int
+compare_chunk(const char *chunk, size_t length, size_t offset, void *data)
+{
+	chunk_compare *compare = data;
+
+	compare->different += offset + length > compare->length ||
+	                      memcmp(chunk, compare->expected + offset, length) != 0 ||
+	                      chunk[length] != '\0';
+	compare->end = offset + length;
+	return 0;
+}
+
+
+static void
+test_chunks(void)
+{
+	RNA_FILE  *rna_file;
+	chunk_log log = {0};
+
+	write_file("chunks.fa", ">c1\nACGUA\nCGUAC\n>c2\nGGGGGGGGGG\n>c3\nAC\n");
+	if(!CHECK((rna_file = rnaf_open("chunks.fa")) != NULL)) {
+		return;
+	}
+
+	CHECK(rnaf_get_chunks(rna_file, log_chunk, 4, 1, &log) == 1);
+	CHECK(strcmp(log.text, "0:ACGU 3:UACG 6:GUAC ") == 0);
+
+	/* Stopping skips the rest of the sequence, the next one starts at its beginning */
+	memset(&log, 0, sizeof log);
+	log.stop_after = 1;
+	CHECK(rnaf_get_chunks(rna_file, log_chunk, 4, 0, &log) == 1);
+	CHECK(strcmp(log.text, "0:GGGG ") == 0);
+
+	memset(&log, 0, sizeof log);
+	CHECK(rnaf_get_chunks(rna_file, log_chunk, 4, 2, &log) == 1);
+	CHECK(strcmp(log.text, "0:AC ") == 0);
+
+	CHECK(rnaf_get_chunks(rna_file, log_chunk, 4, 2, &log) == 0);
+	rnaf_close(rna_file);
+}
+
+
+/* Streams the first record of a file, whose sequence is expected, and checks the read-ahead
+   buffer did not grow to hold its line */
+static void
+test_long(const char *filename, const char *expected)
+{
+	RNA_FILE      *rna_file;
+	chunk_compare compare = {expected, strlen(expected), 0, 0};
+	size_t        stream_size;
+
+	if(!CHECK((rna_file = rnaf_open((char *)filename)) != NULL)) {
+		return;
+	}
+	stream_size = rna_file->stream_size;
+
+	CHECK(rnaf_get_chunks(rna_file, compare_chunk, 1000, 10, &compare) == 1);
+	CHECK(compare.different == 0);
+	CHECK(compare.end == compare.length);
+	CHECK(rna_file->stream_size == stream_size);
+
+	/* The next record starts cleanly after the long line */
+	compare = (chunk_compare) {"ACGU", 4, 0, 0};
+	CHECK(rnaf_get_chunks(rna_file, compare_chunk, 1000, 10, &compare) == 1);
+	CHECK(compare.different == 0 && compare.end == 4);
+	rnaf_close(rna_file);
+}
+
+
+static void
+test_long_lines(void)
+{
+	char          *seq = malloc(LONG_LENGTH+1);
+	char          *text = malloc(2*LONG_LENGTH + 64);
+	unsigned long seed = 3;
+	RNA_FILE      *rna_file;
+	RNA_RECORD    record;
+	chunk_compare compare = {"ACGU", 4, 0, 0};
+	size_t        stream_size;
+
+	if(!CHECK(seq != NULL && text != NULL)) {
+		free(seq);
+		free(text);
+		return;
+	}
+	random_sequence(seq, LONG_LENGTH, &seed);
+
+	sprintf(text, ">chr1 long\n%s\n>next\nACGU\n", seq);
+	write_file("long.fa", text);
+	write_file("long.fa.gz", text);
+	test_long("long.fa", seq);
+	test_long("long.fa.gz", seq);
+
+	sprintf(text, ">chr1\r\n%s\r\n>next\r\nACGU\r\n", seq);
+	write_file("long_crlf.fa", text);
+	test_long("long_crlf.fa", seq);
+
+	sprintf(text, "%s\n\nACGU\n", seq);
+	write_file("long.txt", text);
+	test_long("long.txt", seq);
+
+	/* Qualities are skipped in pieces as well */
+	sprintf(text, "@r1\n%s\n+\n%s\n@r2\nACGU\n+\nIIII\n", seq, seq);
+	write_file("long.fq", text);
+	test_long("long.fq", seq);
+
+	CHECK(rnaf_cache_build("long.fq", "long.rnafc", RNAF_CACHE_NAMES) == 0);
+	test_long("long.rnafc", seq);
+
+	/* Reading a long record whole grows the read-ahead buffer, streaming shrinks it again */
+	if(CHECK((rna_file = rnaf_open("long.fa")) != NULL)) {
+		stream_size = rna_file->stream_size;
+		CHECK(rnaf_next(rna_file, &record) == 1);
+		CHECK(rna_file->stream_size > stream_size);
+		CHECK(rnaf_get_chunks(rna_file, compare_chunk, 1000, 10, &compare) == 1);
+		CHECK(compare.different == 0 && compare.end == 4);
+		CHECK(rna_file->stream_size == stream_size);
+		rnaf_close(rna_file);
+	}
+
+	free(seq);
+	free(text);
+}
+
+
+int
+main(void)
+{
+	test_chunks();
+	test_long_lines();
+
+	return test_result();
+}
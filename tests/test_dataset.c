@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+#define NUM_FILES   4
+#define NUM_RECORDS 15000
+
+
+/* Returns the number of the record named "r<number>" */
+static size_t
+record_number(const RNA_RECORD *record)
+{
+	return strtoul(record->name + 1, NULL, 10);
+}
+
+
+static void
+test_read(char **filenames, int nthreads, size_t memory_budget, int ordered)
+{
+	RNA_DATASET *dataset;
+	RNA_BATCH   *batch;
+	size_t      next[NUM_FILES] = {0};
+	size_t      file;
+	size_t      last_file = 0;
+	size_t      out_of_order = 0;
+	size_t      file_order = 0;
+	int         ret;
+
+	dataset = rnaf_dataset_open(filenames, NUM_FILES, nthreads, memory_budget, ordered);
+	if(!CHECK(dataset != NULL)) {
+		return;
+	}
+
+	while((ret = rnaf_dataset_next(dataset, &batch, &file)) > 0) {
+		if(!CHECK(file < NUM_FILES)) {
+			break;
+		}
+
+		/* Records of a file come in order, and with ordered, every file after the previous one */
+		for(size_t i = 0; i < batch->count; i++) {
+			out_of_order += record_number(&batch->records[i]) != next[file]++;
+		}
+		file_order += ordered && file < last_file;
+		last_file = file;
+	}
+
+	CHECK(ret == 0);
+	CHECK(out_of_order == 0);
+	CHECK(file_order == 0);
+	for(size_t i = 0; i < NUM_FILES; i++) {
+		CHECK(next[i] == NUM_RECORDS);
+		CHECK(strcmp(rnaf_dataset_filename(dataset, i), filenames[i]) == 0);
+	}
+	CHECK(rnaf_dataset_filename(dataset, NUM_FILES) == NULL);
+
+	rnaf_dataset_close(dataset);
+}
+
+
+int
+main(void)
+{
+	char        *filenames[NUM_FILES] = {"run0.fq.gz", "run1.fq", "run2.fq.gz", "run3.fq"};
+	char        *missing[2] = {"run0.fq.gz", "missing.fq"};
+	RNA_DATASET *dataset;
+	RNA_BATCH   *batch;
+	int         ret;
+
+	for(int i = 0; i < NUM_FILES; i++) {
+		write_fastq(filenames[i], NUM_RECORDS, i);
+	}
+
+	test_read(filenames, 1, 0, 1);
+	test_read(filenames, 3, 0, 1);
+	test_read(filenames, 3, 0, 0);
+
+	/* A small budget makes the threads wait for the batches to be handed back */
+	test_read(filenames, 4, 65536, 1);
+	test_read(filenames, 4, 65536, 0);
+
+	/* Close before every batch was handed out */
+	if(CHECK((dataset = rnaf_dataset_open(filenames, NUM_FILES, 2, 65536, 1)) != NULL)) {
+		CHECK(rnaf_dataset_next(dataset, &batch, NULL) > 0);
+		rnaf_dataset_close(dataset);
+	}
+
+	/* Files that cannot be opened are reported when they are reached */
+	if(CHECK((dataset = rnaf_dataset_open(missing, 2, 2, 0, 1)) != NULL)) {
+		while((ret = rnaf_dataset_next(dataset, &batch, NULL)) > 0);
+		CHECK(ret == -1);
+		rnaf_dataset_close(dataset);
+	}
+
+	return test_result();
+}
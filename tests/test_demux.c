@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+
+static void
+test_lookup(void)
+{
+	RNA_DEMUX *demux;
+
+	if(!CHECK((demux = rnaf_demux_create(0, 4, 0, 0)) != NULL)) {
+		return;
+	}
+
+	CHECK(rnaf_demux_add_sample(demux, "ACGT", NULL) == 0);
+	CHECK(rnaf_demux_add_sample(demux, "AAAA", NULL) == 1);
+	CHECK(rnaf_demux_add_sample(demux, "AAAT", NULL) == 2);
+	CHECK(rnaf_demux_add_sample(demux, "ACGT", NULL) == -1);
+	CHECK(rnaf_demux_add_sample(demux, "ACG", NULL) == -1);
+	CHECK(rnaf_demux_add_sample(demux, "ACGN", NULL) == -1);
+
+	/* One mismatch or N is tolerated, U reads as T */
+	CHECK(rnaf_demux_lookup(demux, "ACGT") == 0);
+	CHECK(rnaf_demux_lookup(demux, "ACGU") == 0);
+	CHECK(rnaf_demux_lookup(demux, "ACCT") == 0);
+	CHECK(rnaf_demux_lookup(demux, "NCGT") == 0);
+	CHECK(rnaf_demux_lookup(demux, "AGCT") == -1);
+	CHECK(rnaf_demux_lookup(demux, "GGGG") == -1);
+
+	/* Exact barcodes win over neighbors, neighbors of two barcodes are ambiguous */
+	CHECK(rnaf_demux_lookup(demux, "AAAA") == 1);
+	CHECK(rnaf_demux_lookup(demux, "AAAT") == 2);
+	CHECK(rnaf_demux_lookup(demux, "AAAC") == -1);
+	CHECK(rnaf_demux_lookup(demux, "CAAA") == 1);
+
+	rnaf_demux_free(demux);
+	CHECK(rnaf_demux_create(0, 0, 0, 0) == NULL);
+	CHECK(rnaf_demux_create(0, 22, 0, 0) == NULL);
+}
+
+
+static void
+test_run(void)
+{
+	RNA_DEMUX  *demux;
+	RNA_WRITER *writers[3];
+	RNA_FILE   *rna_file;
+	RNA_RECORD record;
+
+	/* Barcode at 0, UMI at 4 */
+	write_file("reads.fq",
+	           "@r1 lane=1\nACGTGGGCCCC\n+\nABCDEFGHIJK\n"
+	           "@r2\nTTTTAAAGG\n+\nABCDEFGHI\n"
+	           "@r3\nACGAUUUAC\n+\nABCDEFGHI\n"
+	           "@r4\nGGGGCCCAA\n+\nABCDEFGHI\n"
+	           "@r5\nACG\n+\nABC\n");
+
+	demux = rnaf_demux_create(0, 4, 4, 3);
+	writers[0] = rnaf_writer_open("sample0.fq", 'q', RNAF_PLAIN, 0);
+	writers[1] = rnaf_writer_open("sample1.fq.gz", 'q', RNAF_GZIP, 0);
+	writers[2] = rnaf_writer_open("unmatched.fq", 'q', RNAF_PLAIN, 0);
+	rna_file = rnaf_open("reads.fq");
+	if(!CHECK(demux && writers[0] && writers[1] && writers[2] && rna_file)) {
+		return;
+	}
+
+	CHECK(rnaf_demux_add_sample(demux, "ACGT", writers[0]) == 0);
+	CHECK(rnaf_demux_add_sample(demux, "TTTT", writers[1]) == 1);
+	rnaf_demux_set_unmatched(demux, writers[2]);
+
+	CHECK(rnaf_demux_run(demux, rna_file) == 5);
+	CHECK(rnaf_demux_count(demux, 0) == 2);
+	CHECK(rnaf_demux_count(demux, 1) == 1);
+	CHECK(rnaf_demux_count(demux, -1) == 2);
+
+	rnaf_close(rna_file);
+	rnaf_demux_free(demux);
+	for(int i = 0; i < 3; i++) {
+		CHECK(rnaf_writer_close(writers[i]) == 0);
+	}
+
+	/* The barcode and UMI are cut off, and the UMI is appended to the id */
+	if(CHECK((rna_file = rnaf_open("sample0.fq")) != NULL)) {
+		CHECK(rnaf_next(rna_file, &record) == 1);
+		CHECK_STR(record.name, record.name_length, "r1_GGG lane=1");
+		CHECK_STR(record.seq, record.seq_length, "CCCC");
+		CHECK_STR(record.qual, record.qual_length, "HIJK");
+		CHECK(rnaf_next(rna_file, &record) == 1);
+		CHECK_STR(record.name, record.name_length, "r3_UUU");
+		CHECK_STR(record.seq, record.seq_length, "AC");
+		CHECK(rnaf_next(rna_file, &record) == 0);
+		rnaf_close(rna_file);
+	}
+
+	if(CHECK((rna_file = rnaf_open("sample1.fq.gz")) != NULL)) {
+		CHECK(rnaf_next(rna_file, &record) == 1);
+		CHECK_STR(record.name, record.name_length, "r2_AAA");
+		CHECK_STR(record.seq, record.seq_length, "GG");
+		CHECK(rnaf_next(rna_file, &record) == 0);
+		rnaf_close(rna_file);
+	}
+
+	/* Unmatched reads are written as they were read */
+	if(CHECK((rna_file = rnaf_open("unmatched.fq")) != NULL)) {
+		CHECK(rnaf_next(rna_file, &record) == 1);
+		CHECK_STR(record.name, record.name_length, "r4");
+		CHECK_STR(record.seq, record.seq_length, "GGGGCCCAA");
+		CHECK(rnaf_next(rna_file, &record) == 1);
+		CHECK_STR(record.name, record.name_length, "r5");
+		CHECK(rnaf_next(rna_file, &record) == 0);
+		rnaf_close(rna_file);
+	}
+}
+
+
+int
+main(void)
+{
+	test_lookup();
+	test_run();
+
+	return test_result();
+}
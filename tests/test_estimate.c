@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <zlib.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+#define NUM_RECORDS 60000
+#define SAMPLE_SIZE 262144
+
+
+/* Returns the number of characters of a file after decompression */
+static size_t
+decompressed_size(const char *filename)
+{
+	char   buffer[65536];
+	gzFile file = gzopen(filename, "rb");
+	size_t size = 0;
+	int    read;
+
+	while(file && (read = gzread(file, buffer, sizeof buffer)) > 0) {
+		size += read;
+	}
+	if(file) {
+		gzclose(file);
+	}
+
+	return size;
+}
+
+
+/* Writes a copy of a file as a single gzip member */
+static void
+compress_file(const char *source, const char *destination)
+{
+	char   buffer[65536];
+	FILE   *in = fopen(source, "rb");
+	gzFile out = gzopen(destination, "wb");
+	size_t read;
+
+	if(in == NULL || out == NULL) {
+		exit(2);
+	}
+	while((read = fread(buffer, 1, sizeof buffer, in)) > 0) {
+		gzwrite(out, buffer, read);
+	}
+	fclose(in);
+	gzclose(out);
+}
+
+
+/* Copies a file through a writer with the given compression */
+static void
+rewrite_file(const char *source, const char *destination, int compression)
+{
+	RNA_FILE   *rna_file = rnaf_open((char *)source);
+	RNA_WRITER *writer = rnaf_writer_open((char *)destination, 'q', compression, 2);
+	RNA_RECORD record;
+
+	if(rna_file == NULL || writer == NULL) {
+		exit(2);
+	}
+	while(rnaf_next(rna_file, &record) == 1) {
+		CHECK(rnaf_writer_put(writer, &record) == 0);
+	}
+	CHECK(rnaf_writer_close(writer) == 0);
+	rnaf_close(rna_file);
+}
+
+
+/* Checks that an estimate of a large file lies within its error bounds, and that its size is
+   exact if exact_bytes is set */
+static void
+test_sampled(const char *filename, int exact_bytes)
+{
+	RNA_ESTIMATE estimate;
+	double       error;
+	size_t       bytes = decompressed_size(filename);
+
+	CHECK(rnaf_estimate((char *)filename, &estimate, SAMPLE_SIZE) == 0);
+	CHECK(!estimate.exact);
+	CHECK(estimate.sample_records > 0 && estimate.sample_records < NUM_RECORDS);
+	CHECK(estimate.records_error > 0 && estimate.records_error < 0.1);
+
+	error = fabs((double)estimate.num_records - NUM_RECORDS) / NUM_RECORDS;
+	if(!CHECK(error <= estimate.records_error)) {
+		fprintf(stderr, "%s: %zu records estimated, error %f of %f\n", filename,
+		        estimate.num_records, error, estimate.records_error);
+	}
+
+	error = fabs((double)estimate.num_bytes - bytes) / bytes;
+	CHECK(error <= estimate.bytes_error);
+	CHECK(!exact_bytes || (estimate.bytes_error == 0 && estimate.num_bytes == bytes));
+}
+
+
+static void
+test_long_records(void)
+{
+	RNA_ESTIMATE  estimate;
+	FILE          *file = fopen("genome.fa", "wb");
+	char          line[61];
+	unsigned long seed = 5;
+
+	if(!CHECK(file != NULL)) {
+		return;
+	}
+	for(int i = 0; i < 3; i++) {
+		fprintf(file, ">chr%d\n", i);
+		for(int l = 0; l < 10000; l++) {
+			random_sequence(line, 60, &seed);
+			fprintf(file, "%s\n", line);
+		}
+	}
+	fclose(file);
+
+	/* The sample ends inside the first record, which says little about the number of records */
+	CHECK(rnaf_estimate("genome.fa", &estimate, 65536) == 0);
+	CHECK(!estimate.exact);
+	CHECK(estimate.sample_records == 0);
+	CHECK(estimate.num_records >= 1);
+	CHECK(estimate.records_error >= 0.5);
+	CHECK(estimate.num_bytes == decompressed_size("genome.fa"));
+}
+
+
+int
+main(void)
+{
+	RNA_ESTIMATE estimate;
+	RNA_FILE     *rna_file;
+	RNA_RECORD   record;
+	size_t       consumed;
+	size_t       total;
+
+	/* Small files are read whole */
+	write_file("small.fq", "@a\nACGT\n+\nIIII\n@bb\nGG\n+\nII\n");
+	CHECK(rnaf_estimate("small.fq", &estimate, 0) == 0);
+	CHECK(estimate.exact);
+	CHECK(estimate.num_records == 2);
+	CHECK(estimate.sample_records == 2);
+	CHECK(estimate.num_bytes == 27);
+	CHECK(estimate.file_size == 27);
+	CHECK(estimate.records_error == 0 && estimate.bytes_error == 0);
+
+	/* Caches count their records and their sequence, quality and name characters */
+	CHECK(rnaf_cache_build("small.fq", "small.rnafc", RNAF_CACHE_NAMES | RNAF_CACHE_QUALS) == 0);
+	CHECK(rnaf_estimate("small.rnafc", &estimate, 0) == 0);
+	CHECK(estimate.exact);
+	CHECK(estimate.num_records == 2);
+	CHECK(estimate.num_bytes == 15);
+
+	CHECK(rnaf_estimate("missing.fq", &estimate, 0) == -1);
+
+	/* The trailer of single gzip members and the blocks of BGZF files hold their size, the
+	   trailer of the last of several gzip members does not */
+	write_fastq("large.fq", NUM_RECORDS, 5);
+	compress_file("large.fq", "large.fq.gz");
+	rewrite_file("large.fq", "large.fq.bgz", RNAF_BGZF);
+	rewrite_file("large.fq", "members.fq.gz", RNAF_GZIP);
+	test_sampled("large.fq.gz", 1);
+	test_sampled("large.fq.bgz", 1);
+	test_sampled("members.fq.gz", 0);
+	test_sampled("large.fq", 1);
+
+	test_long_records();
+
+	/* Progress goes from the start to the end of the file on disk */
+	if(CHECK((rna_file = rnaf_open("large.fq.gz")) != NULL)) {
+		CHECK(rnaf_progress(rna_file, &consumed, &total) < 0.5);
+		CHECK(total > 0 && total == rna_file->file_size);
+		while(rnaf_next(rna_file, &record) == 1);
+		CHECK(rnaf_progress(rna_file, &consumed, &total) == 1.0);
+		CHECK(consumed == total);
+		rnaf_close(rna_file);
+	}
+
+	return test_result();
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+#define NUM_RECORDS 50
+#define LINE_LENGTH 60
+
+static char sequences[NUM_RECORDS][1000];
+
+
+/* Writes FASTA records named s0, s1, ... with sequences of 0 to 980 characters wrapped at
+   LINE_LENGTH, with "\r\n" line terminators if crlf is set */
+static void
+write_fasta(const char *filename, int crlf)
+{
+	FILE *file = fopen(filename, "wb");
+
+	if(file == NULL) {
+		exit(2);
+	}
+
+	for(int i = 0; i < NUM_RECORDS; i++) {
+		fprintf(file, ">s%d description %d%s", i, i, crlf ? "\r\n" : "\n");
+		for(size_t p = 0; p < strlen(sequences[i]); p += LINE_LENGTH) {
+			fprintf(file, "%.*s%s", LINE_LENGTH, sequences[i] + p, crlf ? "\r\n" : "\n");
+		}
+	}
+
+	fclose(file);
+}
+
+
+static void
+test_index(const char *filename)
+{
+	RNA_INDEX  *index;
+	RNA_CURSOR *cursor;
+	RNA_RECORD record;
+	char       name[16];
+	size_t     length;
+	size_t     different = 0;
+
+	if(!CHECK((index = rnaf_index_open((char *)filename)) != NULL)) {
+		return;
+	}
+	if(!CHECK((cursor = rnaf_index_dup(index)) != NULL)) {
+		rnaf_index_close(index);
+		return;
+	}
+
+	CHECK(rnaf_index_count(index) == NUM_RECORDS);
+	for(int i = 0; i < NUM_RECORDS; i++) {
+		length = strlen(sequences[i]);
+		different += rnaf_index_length(index, i) != length;
+
+		snprintf(name, sizeof name, "s%d", i);
+		different += rnaf_index_find(index, name) != i;
+
+		/* Whole sequences, and regions across line boundaries */
+		different += rnaf_fetch(cursor, i, 0, length, &record) != 1 ||
+		             record.seq_length != length ||
+		             memcmp(record.seq, sequences[i], length) != 0 ||
+		             record.seq[length] != '\0';
+		if(length > 130) {
+			different += rnaf_fetch(cursor, i, 55, 70, &record) != 1 ||
+			             record.seq_length != 70 ||
+			             memcmp(record.seq, sequences[i] + 55, 70) != 0;
+		}
+	}
+	CHECK(different == 0);
+
+	/* Ids end at the first whitespace, of the names and of the lookups */
+	CHECK(rnaf_index_find(index, "s7 description 7") == 7);
+	CHECK(rnaf_index_find(index, "s7 other") == 7);
+	CHECK(rnaf_index_find(index, "s") == -1);
+	CHECK(rnaf_index_find(index, "s500") == -1);
+
+	/* Regions are clamped to the end of the sequence */
+	CHECK(rnaf_fetch(cursor, 3, 10, 1000, &record) == 1);
+	CHECK(record.seq_length == strlen(sequences[3]) - 10);
+	CHECK(memcmp(record.seq, sequences[3] + 10, record.seq_length) == 0);
+	CHECK_STR(record.name, strlen("s3"), "s3");
+
+	CHECK(rnaf_fetch(cursor, 3, strlen(sequences[3]), 10, &record) == 1);
+	CHECK(record.seq_length == 0);
+	CHECK(rnaf_fetch(cursor, 3, strlen(sequences[3]) + 1, 10, &record) == 0);
+	CHECK(rnaf_fetch(cursor, NUM_RECORDS, 0, 10, &record) == 0);
+	CHECK(rnaf_index_length(index, NUM_RECORDS) == 0);
+
+	rnaf_cursor_close(cursor);
+	rnaf_index_close(index);
+}
+
+
+int
+main(void)
+{
+	RNA_INDEX     *index;
+	unsigned long seed = 11;
+
+	for(int i = 0; i < NUM_RECORDS; i++) {
+		random_sequence(sequences[i], i * 20, &seed);
+	}
+
+	write_fasta("index.fa", 0);
+	test_index("index.fa");
+
+	write_fasta("crlf.fa", 1);
+	test_index("crlf.fa");
+
+	/* Compressed files are indexed through a cache */
+	CHECK(rnaf_cache_build("index.fa", "index.rnafc", RNAF_CACHE_NAMES) == 0);
+	test_index("index.rnafc");
+
+	write_file("index.fa.gz", ">s0\nACGT\n");
+	index = rnaf_index_open("index.fa.gz");
+	CHECK(index == NULL);
+	if(index) {
+		rnaf_index_close(index);
+	}
+
+	return test_result();
+}
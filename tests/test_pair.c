@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+#define NUM_PAIRS 12000
+
+
+/* Reads every pair, returns the last result of rnaf_pair_next() and counts the pairs */
+static int
+read_pairs(RNA_PAIR *pair, size_t *count)
+{
+	RNA_RECORD mate1;
+	RNA_RECORD mate2;
+	int        ret;
+
+	*count = 0;
+	while((ret = rnaf_pair_next(pair, &mate1, &mate2)) == 1) {
+		(*count)++;
+	}
+
+	return ret;
+}
+
+
+static void
+test_mate_files(void)
+{
+	RNA_PAIR   *pair;
+	RNA_FILE   *files[2];
+	RNA_RECORD mates[2];
+	RNA_RECORD expected;
+	size_t     count = 0;
+	size_t     different = 0;
+
+	write_fastq("mate1.fq", NUM_PAIRS, 1);
+	write_fastq("mate2.fq.gz", NUM_PAIRS, 2);
+
+	pair = rnaf_open_pair("mate1.fq", "mate2.fq.gz");
+	files[0] = rnaf_open("mate1.fq");
+	files[1] = rnaf_open("mate2.fq.gz");
+	if(!CHECK(pair && files[0] && files[1])) {
+		return;
+	}
+
+	/* Mates come in the order of their files */
+	while(rnaf_pair_next(pair, &mates[0], &mates[1]) == 1) {
+		count++;
+		for(int m = 0; m < 2; m++) {
+			different += rnaf_next(files[m], &expected) != 1 ||
+			             expected.seq_length != mates[m].seq_length ||
+			             memcmp(expected.seq, mates[m].seq, expected.seq_length) != 0;
+		}
+	}
+	CHECK(count == NUM_PAIRS);
+	CHECK(different == 0);
+	CHECK(rnaf_pair_next(pair, &mates[0], &mates[1]) == 0);
+
+	rnaf_close_pair(pair);
+	rnaf_close(files[0]);
+	rnaf_close(files[1]);
+}
+
+
+static void
+test_interleaved(void)
+{
+	RNA_PAIR   *pair;
+	RNA_BATCH  *batches[2];
+	RNA_RECORD mates[2];
+	size_t     count;
+
+	write_file("interleaved.fq", "@a/1\nACGT\n+\nIIII\n@a/2\nTTTT\n+\nIIII\n"
+	                             "@b/1 x\nGG\n+\nII\n@b/2 y\nCC\n+\nII\n");
+	if(!CHECK((pair = rnaf_open_pair("interleaved.fq", NULL)) != NULL)) {
+		return;
+	}
+
+	CHECK(rnaf_pair_batch(pair, &batches[0], &batches[1]) == 2);
+	CHECK_STR(batches[0]->records[0].seq, batches[0]->records[0].seq_length, "ACGT");
+	CHECK_STR(batches[1]->records[0].seq, batches[1]->records[0].seq_length, "TTTT");
+	CHECK_STR(batches[0]->records[1].seq, batches[0]->records[1].seq_length, "GG");
+	CHECK_STR(batches[1]->records[1].seq, batches[1]->records[1].seq_length, "CC");
+	CHECK(rnaf_pair_next(pair, &mates[0], &mates[1]) == 0);
+	rnaf_close_pair(pair);
+
+	/* An odd number of records leaves a mate without its pair */
+	write_file("odd.fq", "@a/1\nACGT\n+\nIIII\n@a/2\nTTTT\n+\nIIII\n@b/1\nGG\n+\nII\n");
+	if(CHECK((pair = rnaf_open_pair("odd.fq", NULL)) != NULL)) {
+		CHECK(read_pairs(pair, &count) == -1);
+		rnaf_close_pair(pair);
+	}
+}
+
+
+static void
+test_errors(void)
+{
+	RNA_PAIR *pair;
+	size_t   count;
+
+	/* Mate files of different lengths */
+	write_fastq("short.fq", NUM_PAIRS - 1, 3);
+	if(CHECK((pair = rnaf_open_pair("mate1.fq", "short.fq")) != NULL)) {
+		CHECK(read_pairs(pair, &count) == -1);
+		rnaf_close_pair(pair);
+	}
+
+	/* Mates with different names */
+	write_file("names1.fq", "@a/1\nACGT\n+\nIIII\n@b/1\nACGT\n+\nIIII\n");
+	write_file("names2.fq", "@a/2\nACGT\n+\nIIII\n@c/2\nACGT\n+\nIIII\n");
+	if(CHECK((pair = rnaf_open_pair("names1.fq", "names2.fq")) != NULL)) {
+		CHECK(read_pairs(pair, &count) == -1);
+		rnaf_close_pair(pair);
+	}
+
+	CHECK(rnaf_open_pair("mate1.fq", "missing.fq") == NULL);
+}
+
+
+int
+main(void)
+{
+	test_mate_files();
+	test_interleaved();
+	test_errors();
+
+	return test_result();
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+static void
+test_fasta(const char *filename)
+{
+	RNA_FILE   *rna_file = rnaf_open((char *)filename);
+	RNA_RECORD record;
+
+	if(!CHECK(rna_file != NULL)) {
+		return;
+	}
+	CHECK(rna_file->filetype == 'a');
+
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.name, record.name_length, "r1 first record");
+	CHECK_STR(record.seq, record.seq_length, "ACGU");
+	CHECK(record.qual == NULL);
+
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.name, record.name_length, "r2");
+	CHECK_STR(record.seq, record.seq_length, "GGCCAAUU");
+
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.name, record.name_length, "r3");
+	CHECK_STR(record.seq, record.seq_length, "");
+
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.name, record.name_length, "r4");
+	CHECK_STR(record.seq, record.seq_length, "NNA");
+
+	CHECK(rnaf_next(rna_file, &record) == 0);
+	rnaf_close(rna_file);
+}
+
+
+/* Records without a sequence must not take the next header as their sequence */
+static void
+test_empty_records(void)
+{
+	RNA_FILE   *rna_file;
+	RNA_RECORD record;
+
+	write_file("empty.fa", ">e1\n>e2\n>e3\nGGG\n>last\nA\nC\n");
+	if(!CHECK((rna_file = rnaf_open("empty.fa")) != NULL)) {
+		return;
+	}
+
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.name, record.name_length, "e1");
+	CHECK(record.seq_length == 0);
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.name, record.name_length, "e2");
+	CHECK(record.seq_length == 0);
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.name, record.name_length, "e3");
+	CHECK_STR(record.seq, record.seq_length, "GGG");
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.name, record.name_length, "last");
+	CHECK_STR(record.seq, record.seq_length, "AC");
+	CHECK(rnaf_next(rna_file, &record) == 0);
+	rnaf_close(rna_file);
+}
+
+
+static void
+test_fastq(void)
+{
+	RNA_FILE   *rna_file;
+	RNA_RECORD record;
+
+	/* Lines end with "\r\n", and the second record spans several lines with a quality
+	   starting with '@' */
+	write_file("crlf.fq", "@q1 x\r\nACGT\r\n+\r\nIIII\r\n@q2\r\nAC\r\nGU\r\n+\r\n@I\r\nJJ\r\n");
+	if(!CHECK((rna_file = rnaf_open("crlf.fq")) != NULL)) {
+		return;
+	}
+	CHECK(rna_file->filetype == 'q');
+
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.name, record.name_length, "q1 x");
+	CHECK_STR(record.seq, record.seq_length, "ACGT");
+	CHECK_STR(record.qual, record.qual_length, "IIII");
+
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.name, record.name_length, "q2");
+	CHECK_STR(record.seq, record.seq_length, "ACGU");
+	CHECK_STR(record.qual, record.qual_length, "@IJJ");
+
+	CHECK(rnaf_next(rna_file, &record) == 0);
+	rnaf_close(rna_file);
+
+	write_file("truncated.fq", "@q1\nACGT\n+\nII\n");
+	if(CHECK((rna_file = rnaf_open("truncated.fq")) != NULL)) {
+		CHECK(rnaf_next(rna_file, &record) == -1);
+		rnaf_close(rna_file);
+	}
+}
+
+
+static void
+test_reads(void)
+{
+	RNA_FILE   *rna_file;
+	RNA_RECORD record;
+	char       *seq;
+
+	write_file("reads.txt", "ACGU\n\nGGCC\nAAA\n");
+	if(!CHECK((rna_file = rnaf_open("reads.txt")) != NULL)) {
+		return;
+	}
+	CHECK(rna_file->filetype == 'r');
+
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK(record.name == NULL);
+	CHECK_STR(record.seq, record.seq_length, "ACGU");
+
+	/* rnaf_get() returns a copy that outlives the next read */
+	seq = rnaf_get(rna_file);
+	CHECK(seq != NULL && strcmp(seq, "GGCC") == 0);
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.seq, record.seq_length, "AAA");
+	CHECK(seq != NULL && strcmp(seq, "GGCC") == 0);
+	free(seq);
+
+	CHECK(rnaf_get(rna_file) == NULL);
+	rnaf_close(rna_file);
+}
+
+
+static void
+test_batches(void)
+{
+	RNA_FILE  *rna_file;
+	RNA_BATCH *batch;
+
+	if(!CHECK((rna_file = rnaf_open("multi.fa")) != NULL)) {
+		return;
+	}
+	if(!CHECK((batch = rnaf_batch_create(3)) != NULL)) {
+		rnaf_close(rna_file);
+		return;
+	}
+
+	CHECK(rnaf_read_batch(rna_file, batch) == 3);
+	CHECK_STR(batch->records[1].seq, batch->records[1].seq_length, "GGCCAAUU");
+	CHECK(rnaf_read_batch(rna_file, batch) == 1);
+	CHECK_STR(batch->records[0].name, batch->records[0].name_length, "r4");
+	CHECK(rnaf_read_batch(rna_file, batch) == 0);
+
+	rnaf_batch_free(batch);
+	rnaf_close(rna_file);
+}
+
+
+int
+main(void)
+{
+	RNA_FILE *rna_file;
+
+	write_file("single.fa", ">r1 first record\nACGU\n>r2\nGGCCAAUU\n>r3\n\n>r4\nNNA\n");
+	write_file("multi.fa", ">r1 first record\nAC\nGU\n>r2\nGGCC\nAAUU\n>r3\n>r4\nNN\nA\n");
+	write_file("multi.fa.gz", ">r1 first record\nAC\nGU\n>r2\nGGCC\nAAUU\n>r3\n>r4\nNN\nA\n");
+
+	test_fasta("single.fa");
+	test_fasta("multi.fa");
+	test_fasta("multi.fa.gz");
+	test_empty_records();
+	test_fastq();
+	test_reads();
+	test_batches();
+
+	/* Empty files are refused when opened */
+	write_file("nothing.fa", "");
+	rna_file = rnaf_open("nothing.fa");
+	CHECK(rna_file == NULL);
+	if(rna_file) {
+		rnaf_close(rna_file);
+	}
+
+	return test_result();
+}
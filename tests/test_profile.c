@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+
+static long
+profile_file(const char *filename, RNA_PROFILE *profile, size_t max_reads, int nthreads)
+{
+	RNA_FILE *rna_file = rnaf_open((char *)filename);
+	long     ret;
+
+	if(!CHECK(rna_file != NULL)) {
+		memset(profile, 0, sizeof *profile);
+		return -1;
+	}
+	ret = rnaf_profile(rna_file, profile, max_reads, nthreads);
+	rnaf_close(rna_file);
+
+	return ret;
+}
+
+
+static void
+test_counts(void)
+{
+	RNA_PROFILE profile;
+
+	/* Bases are counted case-insensitively, U as T, and X as some other character */
+	write_file("counts.fa", ">a\nACGT\n>b\nNNAC\n>c\nacgu\n>d\nAXG\n>e\n");
+	CHECK(profile_file("counts.fa", &profile, 0, 0) == 5);
+
+	CHECK(profile.num_reads == 5);
+	CHECK(profile.num_bases == 15);
+	CHECK(profile.min_length == 0);
+	CHECK(profile.max_length == 4);
+	CHECK(profile.num_positions == 4);
+
+	CHECK(profile.base_counts[RNAF_BASE_A] == 4);
+	CHECK(profile.base_counts[RNAF_BASE_C] == 3);
+	CHECK(profile.base_counts[RNAF_BASE_G] == 3);
+	CHECK(profile.base_counts[RNAF_BASE_T] == 2);
+	CHECK(profile.base_counts[RNAF_BASE_N] == 2);
+	CHECK(profile.base_counts[RNAF_BASE_OTHER] == 1);
+
+	CHECK(profile.position_counts[RNAF_BASE_A][0] == 3);
+	CHECK(profile.position_counts[RNAF_BASE_N][0] == 1);
+	CHECK(profile.position_counts[RNAF_BASE_OTHER][1] == 1);
+	CHECK(profile.position_counts[RNAF_BASE_G][2] == 3);
+	CHECK(profile.position_counts[RNAF_BASE_C][3] == 1);
+	CHECK(profile.position_counts[RNAF_BASE_T][3] == 2);
+
+	CHECK(profile.length_counts[0] == 1);
+	CHECK(profile.length_counts[3] == 1);
+	CHECK(profile.length_counts[4] == 3);
+
+	CHECK(profile.gc_counts[25] == 1);
+	CHECK(profile.gc_counts[33] == 1);
+	CHECK(profile.gc_counts[50] == 2);
+	CHECK(fabs(profile.gc_content - 6.0 / 15) < 1e-9);
+	CHECK(fabs(profile.n_rate - 2.0 / 15) < 1e-9);
+
+	rnaf_profile_free(&profile);
+}
+
+
+/* Worker threads count the same as the calling thread */
+static void
+test_threads(void)
+{
+	RNA_PROFILE serial;
+	RNA_PROFILE threads;
+	size_t      different = 0;
+
+	write_fastq("reads.fq.gz", 20000, 3);
+	CHECK(profile_file("reads.fq.gz", &serial, 0, 0) == 20000);
+	CHECK(profile_file("reads.fq.gz", &threads, 0, 4) == 20000);
+
+	CHECK(serial.num_bases == threads.num_bases);
+	CHECK(serial.min_length == 50 && serial.max_length == 149);
+	CHECK(threads.min_length == 50 && threads.max_length == 149);
+	CHECK(serial.num_positions == 149 && threads.num_positions == 149);
+	for(int b = 0; b < RNAF_NUM_BASES; b++) {
+		different += serial.base_counts[b] != threads.base_counts[b];
+		for(size_t p = 0; p < serial.num_positions; p++) {
+			different += serial.position_counts[b][p] != threads.position_counts[b][p];
+		}
+	}
+	for(size_t l = 0; l <= serial.num_positions; l++) {
+		different += serial.length_counts[l] != threads.length_counts[l];
+	}
+	different += memcmp(serial.gc_counts, threads.gc_counts, sizeof serial.gc_counts) != 0;
+	CHECK(different == 0);
+
+	rnaf_profile_free(&serial);
+	rnaf_profile_free(&threads);
+
+	/* Profiling stops after max_reads records */
+	CHECK(profile_file("reads.fq.gz", &threads, 100, 2) == 100);
+	CHECK(threads.num_reads == 100);
+	rnaf_profile_free(&threads);
+}
+
+
+/* Positions and lengths past RNAF_PROFILE_POSITIONS are binned */
+static void
+test_long_reads(void)
+{
+	RNA_PROFILE profile;
+	char        *contents = malloc(4000);
+
+	strcpy(contents, ">long\n");
+	memset(contents + 6, 'A', 1500);
+	memset(contents + 1506, 'C', 1500);
+	strcpy(contents + 3006, "\n>short\nGGGGGGGGGG\n");
+	write_file("long.fa", contents);
+	free(contents);
+
+	CHECK(profile_file("long.fa", &profile, 0, 2) == 2);
+	CHECK(profile.max_length == 3000);
+	CHECK(profile.num_bases == 3010);
+	CHECK(profile.num_positions == RNAF_PROFILE_POSITIONS);
+	CHECK(profile.position_counts[RNAF_BASE_A][RNAF_PROFILE_POSITIONS-1] == 1);
+	CHECK(profile.position_counts[RNAF_BASE_G][0] == 1);
+	CHECK(profile.overflow_counts[RNAF_BASE_A] == 1500 - RNAF_PROFILE_POSITIONS);
+	CHECK(profile.overflow_counts[RNAF_BASE_C] == 1500);
+	CHECK(profile.overflow_counts[RNAF_BASE_OTHER] == 0);
+	CHECK(profile.base_counts[RNAF_BASE_A] == 1500);
+	CHECK(profile.base_counts[RNAF_BASE_C] == 1500);
+	CHECK(profile.length_counts[10] == 1);
+	CHECK(profile.length_bins[11] == 1);
+
+	rnaf_profile_free(&profile);
+}
+
+
+int
+main(void)
+{
+	test_counts();
+	test_threads();
+	test_long_reads();
+
+	return test_result();
+}
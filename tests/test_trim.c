@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+#define ADAPTER "AGAUCGGAAG"
+
+
+static void
+test_reads(void)
+{
+	RNA_FILE   *rna_file;
+	RNA_RECORD record;
+	char       *seq;
+
+	write_file("trim.txt",
+	           "ACGUACGUAGAUCGG\n"           /* Partial adapter at the 3' end */
+	           "ACGUAGAUCGGAAGCCCC\n"        /* Whole adapter, followed by more bases */
+	           "CCCCAGAUCGGUAGCC\n"          /* One mismatch in ten */
+	           "CCCCAGAACGGUAGCC\n"          /* Two mismatches in ten */
+	           "CCCCCCCCCCAG\n"              /* Partial adapter shorter than the overlap */
+	           "AGAUCGGAAG\n"                /* Nothing but adapter */
+	           "CCCCAGAUCGGAAG\n");
+	if(!CHECK((rna_file = rnaf_open("trim.txt")) != NULL)) {
+		return;
+	}
+	CHECK(rnaf_set_adapter(rna_file, ADAPTER, 0.1, 3) == 0);
+
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.seq, record.seq_length, "ACGUACGU");
+	CHECK(record.seq[record.seq_length] == '\0');
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.seq, record.seq_length, "ACGU");
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.seq, record.seq_length, "CCCC");
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.seq, record.seq_length, "CCCCAGAACGGUAGCC");
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.seq, record.seq_length, "CCCCCCCCCCAG");
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK(record.seq_length == 0);
+
+	/* rnaf_get() returns trimmed copies too */
+	seq = rnaf_get(rna_file);
+	CHECK(seq != NULL && strcmp(seq, "CCCC") == 0);
+	free(seq);
+
+	CHECK(rnaf_next(rna_file, &record) == 0);
+	rnaf_close(rna_file);
+}
+
+
+/* Qualities are cut along with their sequences */
+static void
+test_qualities(void)
+{
+	RNA_FILE   *rna_file;
+	RNA_BATCH  *batch;
+	RNA_RECORD record;
+
+	write_file("trim.fq", "@t1\nGGGGAGAUCGGAAGAA\n+\nABCDEFGHIJKLMNOP\n@t2\nGGGG\n+\nABCD\n");
+	if(!CHECK((rna_file = rnaf_open("trim.fq")) != NULL)) {
+		return;
+	}
+	CHECK(rnaf_set_adapter(rna_file, ADAPTER, 0, 3) == 0);
+
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.seq, record.seq_length, "GGGG");
+	CHECK_STR(record.qual, record.qual_length, "ABCD");
+	CHECK(record.qual[record.qual_length] == '\0');
+	rnaf_close(rna_file);
+
+	/* Batches are trimmed as they are read */
+	if(!CHECK((rna_file = rnaf_open("trim.fq")) != NULL)) {
+		return;
+	}
+	CHECK(rnaf_set_adapter(rna_file, ADAPTER, 0, 3) == 0);
+	if(CHECK((batch = rnaf_batch_create(4)) != NULL)) {
+		CHECK(rnaf_read_batch(rna_file, batch) == 2);
+		CHECK_STR(batch->records[0].seq, batch->records[0].seq_length, "GGGG");
+		CHECK_STR(batch->records[0].qual, batch->records[0].qual_length, "ABCD");
+		CHECK_STR(batch->records[1].seq, batch->records[1].seq_length, "GGGG");
+		rnaf_batch_free(batch);
+	}
+	rnaf_close(rna_file);
+}
+
+
+static void
+test_settings(void)
+{
+	RNA_FILE   *rna_file;
+	RNA_RECORD record;
+
+	if(!CHECK((rna_file = rnaf_open("trim.txt")) != NULL)) {
+		return;
+	}
+
+	/* Error rates outside [0, 1) are rejected and keep the previous adapter */
+	CHECK(rnaf_set_adapter(rna_file, ADAPTER, 0.1, 3) == 0);
+	CHECK(rnaf_set_adapter(rna_file, "CCCC", -0.1, 3) == -1);
+	CHECK(rnaf_set_adapter(rna_file, "CCCC", 1.0, 3) == -1);
+	CHECK(rnaf_set_adapter(rna_file, "CCCC", NAN, 3) == -1);
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.seq, record.seq_length, "ACGUACGU");
+
+	/* A NULL adapter stops trimming */
+	CHECK(rnaf_set_adapter(rna_file, NULL, 0, 0) == 0);
+	CHECK(rnaf_next(rna_file, &record) == 1);
+	CHECK_STR(record.seq, record.seq_length, "ACGUAGAUCGGAAGCCCC");
+
+	rnaf_close(rna_file);
+}
+
+
+int
+main(void)
+{
+	test_reads();
+	test_qualities();
+	test_settings();
+
+	return test_result();
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "test_utils.h"
+
+static int failures;
+
+
+int
+test_check(int passed, const char *expr, const char *file, int line)
+{
+	if(!passed) {
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+		failures++;
+	}
+
+	return passed;
+}
+
+
+int
+test_result(void)
+{
+	if(failures) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+	}
+
+	return failures ? 1 : 0;
+}
+
+
+void
+write_file(const char *filename, const char *contents)
+{
+	size_t length = strlen(contents);
+	size_t name_length = strlen(filename);
+	gzFile gz;
+	FILE   *file;
+
+	if(name_length > 3 && strcmp(filename + name_length - 3, ".gz") == 0) {
+		if((gz = gzopen(filename, "wb")) == NULL || gzwrite(gz, contents, length) != (int)length ||
+		   gzclose(gz) != Z_OK) {
+			fprintf(stderr, "Failed to write '%s'\n", filename);
+			exit(2);
+		}
+		return;
+	}
+
+	if((file = fopen(filename, "wb")) == NULL || fwrite(contents, 1, length, file) != length ||
+	   fclose(file)) {
+		fprintf(stderr, "Failed to write '%s'\n", filename);
+		exit(2);
+	}
+}
+
+
+void
+random_sequence(char *seq, size_t length, unsigned long *state)
+{
+	for(size_t i = 0; i < length; i++) {
+		*state = *state * 6364136223846793005UL + 1442695040888963407UL;
+		seq[i] = "ACGT"[(*state >> 33) & 3];
+	}
+	seq[length] = '\0';
+}
+
+
+void
+write_fastq(const char *filename, size_t num_records, unsigned long seed)
+{
+	RNA_WRITER *writer;
+	RNA_RECORD record;
+	char       name[32];
+	char       seq[160];
+	char       qual[160];
+	size_t     length = strlen(filename);
+
+	writer = rnaf_writer_open((char *)filename, 'q',
+	                          length > 3 && strcmp(filename + length - 3, ".gz") == 0 ?
+	                          RNAF_GZIP : RNAF_PLAIN, 0);
+	if(writer == NULL) {
+		exit(2);
+	}
+
+	memset(qual, 'I', sizeof qual);
+	for(size_t i = 0; i < num_records; i++) {
+		random_sequence(seq, 50 + (seed >> 33) % 100, &seed);
+		record.name = name;
+		record.name_length = snprintf(name, sizeof name, "r%zu", i);
+		record.seq = seq;
+		record.seq_length = strlen(seq);
+		record.qual = qual;
+		record.qual_length = record.seq_length;
+		if(rnaf_writer_put(writer, &record)) {
+			exit(2);
+		}
+	}
+
+	if(rnaf_writer_close(writer)) {
+		exit(2);
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef TEST_UTILS_H
+#define TEST_UTILS_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "rnaf.h"
+
+/**
+ *  @brief Check a condition, reporting it with its location if it does not hold
+ */
+#define CHECK(COND)     test_check((COND), #COND, __FILE__, __LINE__)
+
+/**
+ *  @brief Check that a string of the given length equals a null-terminated string
+ */
+#define CHECK_STR(S, LENGTH, EXPECTED) \
+	CHECK((S) != NULL && (LENGTH) == strlen(EXPECTED) && memcmp((S), (EXPECTED), (LENGTH)) == 0)
+
+/**
+ *  @brief Record the result of a check
+ *
+ *  @param passed   Whether the check passed
+ *  @param expr     The checked expression
+ *  @param file     The file of the check
+ *  @param line     The line of the check
+ *
+ *  @return passed
+*/
+int test_check(int passed, const char *expr, const char *file, int line);
+
+
+/**
+ *  @brief Get the exit status of a test
+ *
+ *  @return 0 if every check passed, or 1
+*/
+int test_result(void);
+
+
+/**
+ *  @brief Write a string to a file, compressed with gzip if the name ends in ".gz"
+ *
+ *  @param filename The name of the file
+ *  @param contents The null-terminated contents
+*/
+void write_file(const char *filename, const char *contents);
+
+
+/**
+ *  @brief Fill a sequence with pseudo-random bases
+ *
+ *  @param seq      Receives length bases and a null terminator
+ *  @param length   The number of bases
+ *  @param state    The state of the generator, updated by the call
+*/
+void random_sequence(char *seq, size_t length, unsigned long *state);
+
+
+/**
+ *  @brief Write pseudo-random FASTQ records named r0, r1, ... with sequences of 50 to 149 bases
+ *
+ *  @param filename     The name of the file, compressed with gzip if it ends in ".gz"
+ *  @param num_records  The number of records
+ *  @param seed         The seed of the sequences
+*/
+void write_fastq(const char *filename, size_t num_records, unsigned long seed);
+
+#endif // TEST_UTILS_H
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rnaf.h"
+#include "test_utils.h"
+
+#define NUM_RECORDS 20000
+
+/* End-of-file marker of BGZF files, an empty BGZF block */
+static const unsigned char bgzf_eof[28] = {
+	0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+	0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+
+/* Checks that two files hold the same records */
+static void
+check_same_records(const char *filename1, const char *filename2)
+{
+	RNA_FILE   *file1 = rnaf_open((char *)filename1);
+	RNA_FILE   *file2 = rnaf_open((char *)filename2);
+	RNA_BATCH  *batch = rnaf_batch_create(NUM_RECORDS);
+	RNA_RECORD record;
+	size_t     count = 0;
+	size_t     different = 0;
+	int        ret;
+
+	if(!CHECK(file1 != NULL && file2 != NULL && batch != NULL)) {
+		goto cleanup;
+	}
+
+	CHECK(rnaf_read_batch(file1, batch) == NUM_RECORDS);
+	while((ret = rnaf_next(file2, &record)) == 1 && count < batch->count) {
+		RNA_RECORD *expected = &batch->records[count++];
+		different += record.seq_length != expected->seq_length ||
+		             memcmp(record.seq, expected->seq, record.seq_length) != 0 ||
+		             record.name_length != expected->name_length ||
+		             memcmp(record.name, expected->name, record.name_length) != 0 ||
+		             (record.qual == NULL) != (expected->qual == NULL) ||
+		             (record.qual && (record.qual_length != expected->qual_length ||
+		                              memcmp(record.qual, expected->qual, record.qual_length)));
+	}
+	CHECK(ret == 0);
+	CHECK(count == NUM_RECORDS);
+	CHECK(different == 0);
+
+cleanup:
+	rnaf_batch_free(batch);
+	if(file1) {
+		rnaf_close(file1);
+	}
+	if(file2) {
+		rnaf_close(file2);
+	}
+}
+
+
+/* Copies every record of a file into a new one */
+static void
+copy_file(const char *input, const char *output, char filetype, int compression, int nthreads)
+{
+	RNA_FILE   *rna_file = rnaf_open((char *)input);
+	RNA_WRITER *writer = rnaf_writer_open((char *)output, filetype, compression, nthreads);
+	RNA_BATCH  *batch = rnaf_batch_create(1000);
+	int        ret;
+
+	if(!CHECK(rna_file != NULL && writer != NULL && batch != NULL)) {
+		exit(test_result());
+	}
+
+	while((ret = rnaf_read_batch(rna_file, batch)) > 0) {
+		CHECK(rnaf_writer_put_batch(writer, batch) == 0);
+	}
+	CHECK(ret == 0);
+	CHECK(rnaf_writer_close(writer) == 0);
+
+	rnaf_batch_free(batch);
+	rnaf_close(rna_file);
+}
+
+
+/* Checks that a file starts with a BGZF block and ends with the BGZF end-of-file marker */
+static void
+check_bgzf(const char *filename)
+{
+	unsigned char header[16];
+	unsigned char footer[sizeof bgzf_eof];
+	FILE          *file = fopen(filename, "rb");
+
+	if(!CHECK(file != NULL)) {
+		return;
+	}
+
+	CHECK(fread(header, 1, sizeof header, file) == sizeof header);
+	CHECK(header[0] == 0x1f && header[1] == 0x8b && (header[3] & 4) && header[12] == 'B' &&
+	      header[13] == 'C');
+	CHECK(fseek(file, -(long)sizeof footer, SEEK_END) == 0);
+	CHECK(fread(footer, 1, sizeof footer, file) == sizeof footer);
+	CHECK(memcmp(footer, bgzf_eof, sizeof footer) == 0);
+
+	fclose(file);
+}
+
+
+int
+main(void)
+{
+	RNA_WRITER *writer;
+	RNA_RECORD record = {.name = "no quality", .name_length = 10, .seq = "ACGU", .seq_length = 4};
+
+	write_fastq("input.fq", NUM_RECORDS, 1);
+
+	copy_file("input.fq", "plain.fq", 'q', RNAF_PLAIN, 0);
+	check_same_records("input.fq", "plain.fq");
+
+	copy_file("input.fq", "serial.fq.gz", 'q', RNAF_GZIP, 0);
+	check_same_records("input.fq", "serial.fq.gz");
+
+	copy_file("input.fq", "threads.fq.gz", 'q', RNAF_GZIP, 3);
+	check_same_records("input.fq", "threads.fq.gz");
+
+	copy_file("input.fq", "serial.fq.bgz", 'q', RNAF_BGZF, 0);
+	check_same_records("input.fq", "serial.fq.bgz");
+	check_bgzf("serial.fq.bgz");
+
+	copy_file("input.fq", "threads.fq.bgz", 'q', RNAF_BGZF, 4);
+	check_same_records("input.fq", "threads.fq.bgz");
+	check_bgzf("threads.fq.bgz");
+
+	/* FASTA output drops the qualities, and reads back as FASTA */
+	copy_file("threads.fq.bgz", "output.fa.gz", 'a', RNAF_BGZF, 2);
+	copy_file("output.fa.gz", "output.fa", 'a', RNAF_PLAIN, 0);
+	check_same_records("output.fa.gz", "output.fa");
+
+	/* FASTQ output needs qualities */
+	if(CHECK((writer = rnaf_writer_open("missing.fq", 'q', RNAF_PLAIN, 0)) != NULL)) {
+		CHECK(rnaf_writer_put(writer, &record) == -1);
+		rnaf_writer_close(writer);
+	}
+
+	/* Unknown file types and compressions are rejected */
+	CHECK(rnaf_writer_open("unknown.fq", 'x', RNAF_PLAIN, 0) == NULL);
+	CHECK(rnaf_writer_open("unknown.fq", 'q', 7, 2) == NULL);
+
+	return test_result();
+}